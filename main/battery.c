@@ -0,0 +1,169 @@
+#include "battery.h"
+#include "board.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "esp_adc/adc_oneshot.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "hid.h"
+#include "main.h"
+#include "sensor.h"
+#include <stdbool.h>
+
+static const char *TAG = "BATTERY";
+
+// The key scan holds the ADC while converting, a read retries until it lands between two frames
+#define BATTERY_READ_RETRIES 10
+// Oneshot reads go through the RTC controller, at its full resolution
+#define BATTERY_ADC_BITWIDTH SOC_ADC_RTC_MAX_BITWIDTH
+#define BATTERY_RAW_COUNT (1 << BATTERY_ADC_BITWIDTH)
+
+struct discharge_point {
+  uint16_t mv;
+  uint8_t level;
+};
+
+// Single Li-ion cell under light load, from full to cut-off
+static const struct discharge_point discharge_curve[] = {
+  { 4200, 100 }, { 4100, 90 }, { 4000, 80 }, { 3920, 70 }, { 3870, 60 }, { 3820, 50 },
+  { 3790, 40 },  { 3770, 30 }, { 3740, 20 }, { 3680, 10 }, { 3450, 5 },  { 3270, 0 },
+};
+
+#define DISCHARGE_POINTS_COUNT (sizeof(discharge_curve) / sizeof(discharge_curve[0]))
+
+static adc_oneshot_unit_handle_t adc_unit = NULL;
+static adc_cali_handle_t adc_cali = NULL;
+
+// Running average of the cell voltage, scaled by 1 << BATTERY_FILTER_SHIFT
+static uint32_t filtered_mv_scaled = 0;
+static uint16_t filtered_mv = 0;
+static uint8_t reported_level = 0;
+static bool has_sample = false;
+static bool is_notify_pending = false;
+static int64_t last_notified_at = 0;
+
+static uint8_t level_from_mv(uint16_t mv) {
+  if (mv >= discharge_curve[0].mv) {
+    return discharge_curve[0].level;
+  }
+
+  for (int i = 1; i < DISCHARGE_POINTS_COUNT; i++) {
+    const struct discharge_point *upper = &discharge_curve[i - 1];
+    const struct discharge_point *lower = &discharge_curve[i];
+    if (mv >= lower->mv) {
+      return lower->level + (mv - lower->mv) * (upper->level - lower->level) / (upper->mv - lower->mv);
+    }
+  }
+  return 0;
+}
+
+static bool read_cell_mv(uint16_t *mv) {
+  int raw = 0;
+  esp_err_t ret = ESP_ERR_TIMEOUT;
+  for (int i = 0; i < BATTERY_READ_RETRIES && ret == ESP_ERR_TIMEOUT; i++) {
+    ret = adc_oneshot_read(adc_unit, BOARD_BATTERY_ADC_CHANNEL, &raw);
+    if (ret == ESP_ERR_TIMEOUT) {
+      vTaskDelay(1);
+    }
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "failed to read the battery: %s", esp_err_to_name(ret));
+    return false;
+  }
+
+  int adc_mv = 0;
+  if (adc_cali == NULL || adc_cali_raw_to_voltage(adc_cali, raw, &adc_mv) != ESP_OK) {
+    adc_mv = raw * ADC_VREF / (BATTERY_RAW_COUNT - 1);
+  }
+  *mv = adc_mv * BOARD_BATTERY_DIVIDER;
+  return true;
+}
+
+static void update_level(int64_t now) {
+  uint8_t level = level_from_mv(filtered_mv);
+  int delta = level - reported_level;
+  bool is_first = !has_sample;
+  has_sample = true;
+
+  // Full and empty are always reached, otherwise the reported level only follows changes larger than the hysteresis
+  if (is_first || delta >= BATTERY_HYSTERESIS_PERCENT || delta <= -BATTERY_HYSTERESIS_PERCENT ||
+      (level != reported_level && (level == 0 || level == 100))) {
+    reported_level = level;
+    is_notify_pending = true;
+    ESP_LOGI(TAG, "%d mV, %d%%", filtered_mv, level);
+  }
+
+  if (!is_notify_pending) {
+    return;
+  }
+
+  // The stored value is always current, notifications wake the radio so they are spaced out
+  bool should_notify = hid_is_connected() && now - last_notified_at >= (int64_t)BATTERY_NOTIFY_MIN_INTERVAL_MS * 1000;
+  hid_set_battery_level(reported_level, should_notify);
+  if (should_notify) {
+    last_notified_at = now;
+    is_notify_pending = false;
+  } else if (!hid_is_connected()) {
+    // The host reads the stored value on reconnection
+    is_notify_pending = false;
+  }
+}
+
+static void battery_task(void *pvParameters) {
+  TickType_t last_wake = xTaskGetTickCount();
+  while (1) {
+    uint16_t mv = 0;
+    if (read_cell_mv(&mv)) {
+      if (!has_sample) {
+        filtered_mv_scaled = (uint32_t)mv << BATTERY_FILTER_SHIFT;
+      } else {
+        filtered_mv_scaled += mv - (filtered_mv_scaled >> BATTERY_FILTER_SHIFT);
+      }
+      filtered_mv = filtered_mv_scaled >> BATTERY_FILTER_SHIFT;
+#if BOARD_SENSOR_SUPPLY_FROM_BATTERY
+      sensor_set_supply_mv(filtered_mv);
+#endif
+      update_level(esp_timer_get_time());
+    }
+    vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(BATTERY_SAMPLE_PERIOD_MS));
+  }
+}
+
+void battery_init() {
+  adc_oneshot_unit_init_cfg_t unit_config = {
+    .unit_id = BOARD_BATTERY_ADC_UNIT,
+  };
+  ESP_ERROR_CHECK(adc_oneshot_new_unit(&unit_config, &adc_unit));
+
+  adc_oneshot_chan_cfg_t channel_config = {
+    .atten = ADC_ATTEN_DB_12,
+    .bitwidth = BATTERY_ADC_BITWIDTH,
+  };
+  ESP_ERROR_CHECK(adc_oneshot_config_channel(adc_unit, BOARD_BATTERY_ADC_CHANNEL, &channel_config));
+
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+  adc_cali_curve_fitting_config_t cali_config = {
+    .unit_id = BOARD_BATTERY_ADC_UNIT,
+    .chan = BOARD_BATTERY_ADC_CHANNEL,
+    .atten = ADC_ATTEN_DB_12,
+    .bitwidth = BATTERY_ADC_BITWIDTH,
+  };
+  esp_err_t ret = adc_cali_create_scheme_curve_fitting(&cali_config, &adc_cali);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "no ADC calibration, battery voltage is estimated: %s", esp_err_to_name(ret));
+    adc_cali = NULL;
+  }
+#endif
+
+  xTaskCreate(battery_task, "battery_task", 2048, NULL, 2, NULL);
+}
+
+uint16_t battery_get_mv() {
+  return filtered_mv;
+}
+
+uint8_t battery_get_level() {
+  return reported_level;
+}
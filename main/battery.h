@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+// Time between two battery samples, the cell voltage moves over minutes
+#define BATTERY_SAMPLE_PERIOD_MS 2000
+// Weight of each new sample in the running voltage average, 1 / (1 << shift)
+#define BATTERY_FILTER_SHIFT 3
+// Change of the estimated level needed before the reported one follows it
+#define BATTERY_HYSTERESIS_PERCENT 2
+// Minimum time between two battery level notifications to the host
+#define BATTERY_NOTIFY_MIN_INTERVAL_MS (60 * 1000)
+
+/**
+ * @brief Start sampling the battery on its own low-priority task, outside the key scan pattern
+ */
+void battery_init(void);
+
+/**
+ * @brief Get the filtered cell voltage, 0 until the first sample
+ */
+uint16_t battery_get_mv(void);
+
+/**
+ * @brief Get the level reported to the host, in percent
+ */
+uint8_t battery_get_level(void);
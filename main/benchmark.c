@@ -0,0 +1,658 @@
+#include "benchmark.h"
+#include "crosstalk.h"
+#include "drift.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "main.h"
+#include "noise.h"
+#include "sensor.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if BENCHMARK_KEY_ENGINE
+
+static const char *TAG = "BENCHMARK";
+
+#define BENCHMARK_WARMUP_FRAMES 200
+#define BENCHMARK_FRAMES 2000
+
+// Array-of-structs layout the key engine used before the hot fields were split out, run with the same
+// integer arithmetic as update_key_state so that only the layout differs between the two
+struct aos_key {
+  struct key_config config;
+  uint16_t idle_value;
+  uint16_t max_distance;
+  uint32_t scale;
+  uint8_t distance;
+
+  uint8_t is_idle;
+  enum key_direction direction;
+  uint8_t from;
+  uint32_t since;
+  enum key_status status;
+  uint32_t triggered_at;
+};
+
+static struct aos_key aos_keys[BENCHMARK_MAX_KEYS];
+static struct key_config soa_configs[BENCHMARK_MAX_KEYS];
+static struct keys_state soa_state;
+static uint16_t raw_values[BENCHMARK_MAX_KEYS];
+// Sample times fed along with raw_values, the replays that do not look at event times leave them as they are
+static uint32_t sampled_at[BENCHMARK_MAX_KEYS];
+
+static void update_aos_keys(struct aos_key *keys, const uint16_t *raw_values, int count) {
+  for (int i = 0; i < count; i++) {
+    uint16_t normalized_value = 0;
+    if (keys[i].config.hardware.magnet_polarity == NORTH_POLE_FACING_DOWN) {
+      normalized_value = ADC_VREF - raw_values[i];
+    } else {
+      normalized_value = raw_values[i];
+    }
+
+    if (normalized_value < keys[i].idle_value) {
+      keys[i].idle_value = (normalized_value + 4 * keys[i].idle_value) / 5;
+    }
+
+    uint16_t distance = 0;
+    if (normalized_value > keys[i].idle_value) {
+      distance = normalized_value - keys[i].idle_value;
+    }
+
+    if (distance > keys[i].max_distance) {
+      keys[i].max_distance = distance;
+      keys[i].scale = (255 << 16) / distance;
+    }
+
+    if (distance + keys[i].config.deadzones.end_offset >= keys[i].max_distance) {
+      keys[i].distance = 255;
+      keys[i].is_idle = 0;
+    } else if (distance <= keys[i].config.deadzones.start_offset) {
+      keys[i].distance = 0;
+      keys[i].is_idle = 1;
+    } else {
+      keys[i].distance = (distance * keys[i].scale) >> 16;
+      keys[i].is_idle = 0;
+    }
+  }
+}
+
+// Every key travels up and down with its own phase, so all branches get taken
+static void fill_raw_values(int frame, int count) {
+  for (int i = 0; i < count; i++) {
+    int phase = (frame + i * 37) % 200;
+    int travel = phase < 100 ? phase : 200 - phase;
+    raw_values[i] = 2800 - travel * 15;
+    sampled_at[i] = frame * 1000;
+  }
+}
+
+static void reset_keys(int count) {
+  memset(aos_keys, 0, sizeof(aos_keys));
+  memset(soa_configs, 0, sizeof(soa_configs));
+
+  for (int i = 0; i < count; i++) {
+    soa_configs[i].hardware.magnet_polarity = NORTH_POLE_FACING_DOWN;
+    soa_configs[i].deadzones.start_offset = 17;
+    soa_configs[i].deadzones.end_offset = 17;
+
+    aos_keys[i].config = soa_configs[i];
+    aos_keys[i].idle_value = ADC_VREF - 2800;
+    aos_keys[i].max_distance = MAX_DISTANCE_PRE_CALIBRATION;
+    aos_keys[i].scale = (255 << 16) / MAX_DISTANCE_PRE_CALIBRATION;
+  }
+
+  init_keys_state(&soa_state, soa_configs, count);
+  for (int i = 0; i < count; i++) {
+    soa_state.idle_value[i] = ADC_VREF - 2800;
+  }
+}
+
+static uint32_t run_aos(int count) {
+  uint32_t cycles = 0;
+  for (int frame = 0; frame < BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES; frame++) {
+    fill_raw_values(frame, count);
+    uint32_t started_at = esp_cpu_get_cycle_count();
+    update_aos_keys(aos_keys, raw_values, count);
+    if (frame >= BENCHMARK_WARMUP_FRAMES) {
+      cycles += esp_cpu_get_cycle_count() - started_at;
+    }
+  }
+  return cycles / BENCHMARK_FRAMES;
+}
+
+static uint32_t run_soa(int count, uint8_t is_tracked) {
+  for (int i = 0; i < count; i++) {
+    soa_state.is_tracked[i] = is_tracked;
+  }
+
+  uint32_t cycles = 0;
+  for (int frame = 0; frame < BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES; frame++) {
+    fill_raw_values(frame, count);
+    uint32_t started_at = esp_cpu_get_cycle_count();
+    update_keys_state(&soa_state, raw_values, sampled_at, count, 0);
+    if (frame >= BENCHMARK_WARMUP_FRAMES) {
+      cycles += esp_cpu_get_cycle_count() - started_at;
+    }
+  }
+  return cycles / BENCHMARK_FRAMES;
+}
+
+#define REPLAY_CYCLE_FRAMES 200
+#define REPLAY_CYCLES 100
+#define REPLAY_CALIBRATION_FRAMES 50
+#define REPLAY_SUPPLY_START_MV 4200
+#define REPLAY_SUPPLY_END_MV 3300
+
+enum replay_key {
+  REPLAY_KEY_RAW,
+  REPLAY_KEY_COMPENSATED,
+  REPLAY_KEYS_COUNT,
+};
+
+// Ratiometric sensor reading for a travel from 0 to 100, proportional to the supply
+static uint16_t sag_sensor_reading(int travel, uint16_t supply_mv) {
+  uint32_t nominal_reading = 1400 + travel * 12;
+  return nominal_reading * supply_mv / BOARD_SENSOR_SUPPLY_NOMINAL_MV;
+}
+
+// Same key pressed over and over while the cell discharges, with and without supply compensation
+static void replay_supply_sag() {
+  struct key_config configs[REPLAY_KEYS_COUNT] = { 0 };
+  uint8_t mid_travel_distances[REPLAY_KEYS_COUNT][2] = { 0 };
+  uint16_t raw_values[REPLAY_KEYS_COUNT];
+
+  for (int i = 0; i < REPLAY_KEYS_COUNT; i++) {
+    configs[i].hardware.magnet_polarity = SOUTH_POLE_FACING_DOWN;
+    configs[i].deadzones.start_offset = 17;
+    configs[i].deadzones.end_offset = 17;
+  }
+  init_keys_state(&soa_state, configs, REPLAY_KEYS_COUNT);
+
+  const int frames = REPLAY_CYCLES * REPLAY_CYCLE_FRAMES;
+  for (int frame = 0; frame < frames; frame++) {
+    uint16_t supply_mv = REPLAY_SUPPLY_START_MV - (REPLAY_SUPPLY_START_MV - REPLAY_SUPPLY_END_MV) * frame / frames;
+    int phase = frame % REPLAY_CYCLE_FRAMES;
+    int travel = phase < REPLAY_CYCLE_FRAMES / 2 ? phase : REPLAY_CYCLE_FRAMES - phase;
+    if (frame < REPLAY_CALIBRATION_FRAMES) {
+      travel = 0;
+    }
+
+    uint16_t reading = sag_sensor_reading(travel, supply_mv);
+    raw_values[REPLAY_KEY_RAW] = reading;
+    raw_values[REPLAY_KEY_COMPENSATED] = sensor_compensate_supply(reading, sensor_get_supply_gain(supply_mv));
+    update_keys_state(&soa_state, raw_values, sampled_at, REPLAY_KEYS_COUNT, frame < REPLAY_CALIBRATION_FRAMES);
+
+    // The first cycle teaches the max distance, compare the second one with the last one
+    int cycle = frame / REPLAY_CYCLE_FRAMES;
+    if (phase == REPLAY_CYCLE_FRAMES / 4 && (cycle == 1 || cycle == REPLAY_CYCLES - 1)) {
+      for (int i = 0; i < REPLAY_KEYS_COUNT; i++) {
+        mid_travel_distances[i][cycle == 1 ? 0 : 1] = soa_state.distance[i];
+      }
+    }
+  }
+
+  ESP_LOGI(TAG, "supply sag %d -> %d mV, mid-travel distance %d -> %d raw, %d -> %d compensated",
+           REPLAY_SUPPLY_START_MV, REPLAY_SUPPLY_END_MV,
+           mid_travel_distances[REPLAY_KEY_RAW][0], mid_travel_distances[REPLAY_KEY_RAW][1],
+           mid_travel_distances[REPLAY_KEY_COMPENSATED][0], mid_travel_distances[REPLAY_KEY_COMPENSATED][1]);
+}
+
+#define TRACKER_PRESSES 20
+#define TRACKER_RAMP_FRAMES 20
+#define TRACKER_HOLD_FRAMES 100
+#define TRACKER_REST_FRAMES 60
+#define TRACKER_PRESS_FRAMES (2 * TRACKER_RAMP_FRAMES + TRACKER_HOLD_FRAMES + TRACKER_REST_FRAMES)
+#define TRACKER_SETTLE_FRAMES 20
+#define TRACKER_NOISE_MV 12
+#define TRACKER_ACTUATION_DISTANCE 128
+
+enum tracker_key {
+  TRACKER_KEY_REFERENCE,
+  TRACKER_KEY_SAMPLED,
+  TRACKER_KEY_TRACKED,
+  TRACKER_KEYS_COUNT,
+};
+
+static uint32_t noise_seed = 1;
+
+// Triangular noise from two uniform draws, reproducible from run to run
+static int triangular_noise(int amplitude_mv) {
+  int noise = 0;
+  for (int i = 0; i < 2; i++) {
+    noise_seed = noise_seed * 1664525 + 1013904223;
+    noise += (int)(noise_seed >> 16) % (amplitude_mv + 1);
+  }
+  return noise - amplitude_mv;
+}
+
+static int tracker_noise() {
+  return triangular_noise(TRACKER_NOISE_MV);
+}
+
+static int tracker_travel(int phase) {
+  if (phase < TRACKER_RAMP_FRAMES) {
+    return phase * 100 / TRACKER_RAMP_FRAMES;
+  }
+  phase -= TRACKER_RAMP_FRAMES;
+  if (phase < TRACKER_HOLD_FRAMES) {
+    return 100;
+  }
+  phase -= TRACKER_HOLD_FRAMES;
+  if (phase < TRACKER_RAMP_FRAMES) {
+    return 100 - phase * 100 / TRACKER_RAMP_FRAMES;
+  }
+  return 0;
+}
+
+// Presses replayed through a noiseless reference key, a noisy key as sampled and the same noisy key tracked;
+// noise is measured while held down, lag as the frames behind the reference to actuation
+static void replay_tracker() {
+  struct key_config configs[TRACKER_KEYS_COUNT] = { 0 };
+  uint16_t raw_values[TRACKER_KEYS_COUNT];
+  uint64_t squared_errors[TRACKER_KEYS_COUNT] = { 0 };
+  int32_t lag_frames[TRACKER_KEYS_COUNT] = { 0 };
+  int actuated_at[TRACKER_KEYS_COUNT];
+  uint32_t held_samples = 0;
+
+  for (int i = 0; i < TRACKER_KEYS_COUNT; i++) {
+    configs[i].hardware.magnet_polarity = SOUTH_POLE_FACING_DOWN;
+    configs[i].deadzones.start_offset = 17;
+    configs[i].deadzones.end_offset = 17;
+  }
+  init_keys_state(&soa_state, configs, TRACKER_KEYS_COUNT);
+  soa_state.is_tracked[TRACKER_KEY_TRACKED] = 1;
+
+  for (int frame = 0; frame < REPLAY_CALIBRATION_FRAMES; frame++) {
+    for (int i = 0; i < TRACKER_KEYS_COUNT; i++) {
+      raw_values[i] = 1400 + (i == TRACKER_KEY_REFERENCE ? 0 : tracker_noise());
+    }
+    update_keys_state(&soa_state, raw_values, sampled_at, TRACKER_KEYS_COUNT, 1);
+  }
+
+  for (int press = 0; press < TRACKER_PRESSES; press++) {
+    for (int i = 0; i < TRACKER_KEYS_COUNT; i++) {
+      actuated_at[i] = -1;
+    }
+
+    for (int phase = 0; phase < TRACKER_PRESS_FRAMES; phase++) {
+      uint16_t reading = 1400 + tracker_travel(phase) * 12;
+      int noise = tracker_noise();
+      raw_values[TRACKER_KEY_REFERENCE] = reading;
+      raw_values[TRACKER_KEY_SAMPLED] = reading + noise;
+      raw_values[TRACKER_KEY_TRACKED] = reading + noise;
+      update_keys_state(&soa_state, raw_values, sampled_at, TRACKER_KEYS_COUNT, 0);
+
+      for (int i = 0; i < TRACKER_KEYS_COUNT; i++) {
+        if (actuated_at[i] < 0 && soa_state.distance[i] >= TRACKER_ACTUATION_DISTANCE) {
+          actuated_at[i] = phase;
+        }
+      }
+
+      bool is_held = phase >= TRACKER_RAMP_FRAMES + TRACKER_SETTLE_FRAMES && phase < TRACKER_RAMP_FRAMES + TRACKER_HOLD_FRAMES;
+      if (is_held) {
+        for (int i = 0; i < TRACKER_KEYS_COUNT; i++) {
+          int32_t error = (int32_t)soa_state.normalized_value[i] - soa_state.normalized_value[TRACKER_KEY_REFERENCE];
+          squared_errors[i] += error * error;
+        }
+        held_samples++;
+      }
+    }
+
+    // The first press teaches the max distance
+    if (press > 0) {
+      for (int i = 0; i < TRACKER_KEYS_COUNT; i++) {
+        lag_frames[i] += actuated_at[i] - actuated_at[TRACKER_KEY_REFERENCE];
+      }
+    }
+  }
+
+  ESP_LOGI(TAG, "tracker replay, held noise variance %" PRIu32 " mV^2 sampled, %" PRIu32 " mV^2 tracked, "
+                "actuation lag %" PRId32 "/%d frames sampled, %" PRId32 "/%d frames tracked",
+           (uint32_t)(squared_errors[TRACKER_KEY_SAMPLED] / held_samples),
+           (uint32_t)(squared_errors[TRACKER_KEY_TRACKED] / held_samples),
+           lag_frames[TRACKER_KEY_SAMPLED], TRACKER_PRESSES - 1, lag_frames[TRACKER_KEY_TRACKED], TRACKER_PRESSES - 1);
+}
+
+#define NOISE_REPLAY_FRAMES 2000
+
+// Released keys with growing noise, each reporting the start deadzone derived from its own noise
+static void replay_noise() {
+  const int amplitudes_mv[] = { 1, 3, 6, 10 };
+  const int amplitudes_count = sizeof(amplitudes_mv) / sizeof(amplitudes_mv[0]);
+  struct key_config configs[KEYS_COUNT] = { 0 };
+  uint16_t raw_values[KEYS_COUNT];
+
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    configs[i].hardware.magnet_polarity = SOUTH_POLE_FACING_DOWN;
+    configs[i].deadzones.start_offset = 17;
+    configs[i].deadzones.end_offset = 17;
+  }
+  init_keys_state(&soa_state, configs, KEYS_COUNT);
+
+  for (int frame = 0; frame < REPLAY_CALIBRATION_FRAMES + NOISE_REPLAY_FRAMES; frame++) {
+    for (int i = 0; i < KEYS_COUNT; i++) {
+      raw_values[i] = 1400 + triangular_noise(amplitudes_mv[i % amplitudes_count]);
+    }
+    bool is_calibrating = frame < REPLAY_CALIBRATION_FRAMES;
+    update_keys_state(&soa_state, raw_values, sampled_at, KEYS_COUNT, is_calibrating);
+    if (!is_calibrating) {
+      noise_update(&soa_state, KEYS_COUNT, (1 << KEYS_COUNT) - 1);
+    }
+  }
+
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    ESP_LOGI(TAG, "noise replay, key %d: noise %d mV, start deadzone %d mV", i, amplitudes_mv[i % amplitudes_count],
+             soa_state.start_offset[i]);
+  }
+}
+
+#define DRIFT_REPLAY_WINDOWS 170
+// Travel shrinks by 10 mV per window, far faster than the max distance step, then the bounds catch up
+#define DRIFT_REPLAY_DRIFTING_WINDOWS 20
+#define DRIFT_REPLAY_IDLE_MV 1400
+#define DRIFT_REPLAY_IDLE_SHIFT_MV 80
+#define DRIFT_REPLAY_TRAVEL_MV 1200
+#define DRIFT_REPLAY_TRAVEL_SHIFT_MV -200
+
+enum drift_key {
+  DRIFT_KEY_TRACKED,
+  DRIFT_KEY_UNTRACKED,
+  DRIFT_KEYS_COUNT,
+};
+
+// Two keys pressed and released once per drift window while their idle reading rises and their travel shrinks,
+// only the first one handed to drift tracking; errors are the bounds' distance to the truth at the end
+static void replay_drift() {
+  struct key_config configs[DRIFT_KEYS_COUNT] = { 0 };
+  uint16_t raw_values[DRIFT_KEYS_COUNT];
+  int32_t idle_mv = DRIFT_REPLAY_IDLE_MV;
+  int32_t travel_mv = DRIFT_REPLAY_TRAVEL_MV;
+
+  for (int i = 0; i < DRIFT_KEYS_COUNT; i++) {
+    configs[i].hardware.magnet_polarity = SOUTH_POLE_FACING_DOWN;
+    configs[i].deadzones.start_offset = 17;
+    configs[i].deadzones.end_offset = 17;
+  }
+  init_keys_state(&soa_state, configs, DRIFT_KEYS_COUNT);
+  drift_init();
+
+  for (int frame = 0; frame < REPLAY_CALIBRATION_FRAMES; frame++) {
+    raw_values[DRIFT_KEY_TRACKED] = raw_values[DRIFT_KEY_UNTRACKED] = idle_mv;
+    update_keys_state(&soa_state, raw_values, sampled_at, DRIFT_KEYS_COUNT, 1);
+  }
+
+  for (int frame = 0; frame < DRIFT_REPLAY_WINDOWS * DRIFT_WINDOW_FRAMES; frame++) {
+    int window = frame / DRIFT_WINDOW_FRAMES;
+    if (window < DRIFT_REPLAY_DRIFTING_WINDOWS) {
+      idle_mv = DRIFT_REPLAY_IDLE_MV + DRIFT_REPLAY_IDLE_SHIFT_MV * frame / (DRIFT_REPLAY_DRIFTING_WINDOWS * DRIFT_WINDOW_FRAMES);
+      travel_mv = DRIFT_REPLAY_TRAVEL_MV + DRIFT_REPLAY_TRAVEL_SHIFT_MV * frame / (DRIFT_REPLAY_DRIFTING_WINDOWS * DRIFT_WINDOW_FRAMES);
+    }
+    bool is_pressed = frame % DRIFT_WINDOW_FRAMES >= DRIFT_WINDOW_FRAMES / 2;
+    raw_values[DRIFT_KEY_TRACKED] = raw_values[DRIFT_KEY_UNTRACKED] = idle_mv + (is_pressed ? travel_mv : 0);
+
+    drift_apply(&soa_state, DRIFT_KEY_TRACKED + 1);
+    update_keys_state(&soa_state, raw_values, sampled_at, DRIFT_KEYS_COUNT, 0);
+    // Lower priority than the drift task, which takes each window as soon as it is handed over
+    drift_observe(&soa_state, DRIFT_KEY_TRACKED + 1, 1 << DRIFT_KEY_TRACKED);
+  }
+
+  int32_t errors[DRIFT_KEYS_COUNT][2];
+  for (int i = 0; i < DRIFT_KEYS_COUNT; i++) {
+    errors[i][0] = abs((int32_t)soa_state.idle_value[i] - idle_mv);
+    errors[i][1] = abs((int32_t)soa_state.max_distance[i] - travel_mv);
+  }
+  ESP_LOGI(TAG, "drift replay, idle %+d mV, travel %+d mV, idle/max distance error %" PRId32 "/%" PRId32 " mV untracked, "
+                "%" PRId32 "/%" PRId32 " mV tracked",
+           DRIFT_REPLAY_IDLE_SHIFT_MV, DRIFT_REPLAY_TRAVEL_SHIFT_MV, errors[DRIFT_KEY_UNTRACKED][0],
+           errors[DRIFT_KEY_UNTRACKED][1], errors[DRIFT_KEY_TRACKED][0], errors[DRIFT_KEY_TRACKED][1]);
+}
+
+#define CROSSTALK_REPLAY_REST_MV 1500
+#define CROSSTALK_REPLAY_TRAVEL_MV 1200
+#define CROSSTALK_REPLAY_PRESS_FRAMES 300
+// Share of a pressed key's travel read by its direct neighbours and by the keys further away, in percent
+#define CROSSTALK_REPLAY_NEIGHBOUR_PERCENT 8
+#define CROSSTALK_REPLAY_OTHER_PERCENT 2
+
+static struct keys_state corrected_state;
+
+// Keys in a row, each magnet shifting its neighbours' readings
+static void crosstalk_frame(uint16_t samples[KEYS_COUNT], int pressed, int travel_mv) {
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    int percent = i == pressed ? 100 : (abs(i - pressed) == 1 ? CROSSTALK_REPLAY_NEIGHBOUR_PERCENT : CROSSTALK_REPLAY_OTHER_PERCENT);
+    samples[i] = CROSSTALK_REPLAY_REST_MV + tracker_noise() / 4 + (pressed >= 0 ? travel_mv * percent / 100 : 0);
+  }
+}
+
+// Stands in for the scan task through the calibration procedure
+static void crosstalk_feeder(void *pvParameters) {
+  TaskHandle_t benchmark_task = pvParameters;
+  uint16_t samples[KEYS_COUNT];
+
+  for (int frame = 0; frame < CROSSTALK_REST_FRAMES; frame++) {
+    crosstalk_frame(samples, -1, 0);
+    crosstalk_correct(samples, &corrected_state);
+  }
+  for (int key = 0; key < KEYS_COUNT; key++) {
+    for (int frame = 0; frame < CROSSTALK_REPLAY_PRESS_FRAMES; frame++) {
+      crosstalk_frame(samples, key, CROSSTALK_REPLAY_TRAVEL_MV);
+      crosstalk_correct(samples, &corrected_state);
+    }
+  }
+  xTaskNotifyGive(benchmark_task);
+
+  // Keep scanning released keys until the calibration is taken back
+  while (crosstalk_get_state() != CROSSTALK_IDLE) {
+    crosstalk_frame(samples, -1, 0);
+    crosstalk_correct(samples, &corrected_state);
+    vTaskDelay(1);
+  }
+  xTaskNotifyGive(benchmark_task);
+  vTaskDelete(NULL);
+}
+
+// Calibrate the matrix on one pass of single presses, then replay presses with and without correction;
+// ghost travel is the largest distance reached by a key that is not pressed
+static void replay_crosstalk() {
+  struct key_config configs[KEYS_COUNT] = { 0 };
+  uint16_t samples[KEYS_COUNT];
+  uint8_t ghost_distances[2] = { 0 };
+  uint32_t correction_cycles = 0;
+  uint32_t corrected_frames = 0;
+
+  crosstalk_start_calibration();
+  xTaskCreate(crosstalk_feeder, "crosstalk_feeder", 2048, xTaskGetCurrentTaskHandle(), 5, NULL);
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  // Nothing is stored while the benchmark runs without NVS, the matrix still applies
+  crosstalk_finish_calibration();
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    configs[i].hardware.magnet_polarity = SOUTH_POLE_FACING_DOWN;
+    configs[i].deadzones.start_offset = 17;
+    configs[i].deadzones.end_offset = 17;
+  }
+  init_keys_state(&soa_state, configs, KEYS_COUNT);
+  init_keys_state(&corrected_state, configs, KEYS_COUNT);
+
+  for (int frame = 0; frame < REPLAY_CALIBRATION_FRAMES; frame++) {
+    crosstalk_frame(samples, -1, 0);
+    update_keys_state(&soa_state, samples, sampled_at, KEYS_COUNT, 1);
+    crosstalk_correct(samples, &corrected_state);
+    update_keys_state(&corrected_state, samples, sampled_at, KEYS_COUNT, 1);
+  }
+
+  for (int key = 0; key < KEYS_COUNT; key++) {
+    for (int phase = 0; phase < TRACKER_PRESS_FRAMES; phase++) {
+      crosstalk_frame(samples, key, tracker_travel(phase) * CROSSTALK_REPLAY_TRAVEL_MV / 100);
+      update_keys_state(&soa_state, samples, sampled_at, KEYS_COUNT, 0);
+      uint32_t started_at = esp_cpu_get_cycle_count();
+      crosstalk_correct(samples, &corrected_state);
+      correction_cycles += esp_cpu_get_cycle_count() - started_at;
+      corrected_frames++;
+      update_keys_state(&corrected_state, samples, sampled_at, KEYS_COUNT, 0);
+
+      for (int i = 0; i < KEYS_COUNT; i++) {
+        if (i == key) {
+          continue;
+        }
+        if (soa_state.distance[i] > ghost_distances[0]) {
+          ghost_distances[0] = soa_state.distance[i];
+        }
+        if (corrected_state.distance[i] > ghost_distances[1]) {
+          ghost_distances[1] = corrected_state.distance[i];
+        }
+      }
+    }
+  }
+
+  ESP_LOGI(TAG, "crosstalk replay, neighbour coefficient %d/%d, ghost distance %d uncorrected, %d corrected, %" PRIu32 " cycles/frame",
+           crosstalk_get_coefficient(1, 0), 1 << CROSSTALK_COEFFICIENT_SHIFT, ghost_distances[0], ghost_distances[1],
+           correction_cycles / corrected_frames);
+}
+
+#define TIMESTAMP_PRESSES 20
+#define TIMESTAMP_FRAME_US 1000
+#define TIMESTAMP_FINE_US 10
+#define TIMESTAMP_TICK_US 1000
+// The report task polls every 10 ms
+#define TIMESTAMP_POLL_US 10000
+#define TIMESTAMP_HOLD_US 30000
+#define TIMESTAMP_REST_US 30000
+#define TIMESTAMP_PRESS_US 120000
+
+enum timestamp_method {
+  TIMESTAMP_TICK,
+  TIMESTAMP_FRAME,
+  TIMESTAMP_INTERPOLATED,
+  TIMESTAMP_METHODS_COUNT,
+};
+
+static struct keys_state reference_state;
+
+// Eased press and release so the travel is not linear between two frames, each press with its own speed
+static int timestamp_travel(uint32_t at, uint32_t ramp_us) {
+  if (at >= 2 * ramp_us + TIMESTAMP_HOLD_US) {
+    return 0;
+  }
+  if (at >= ramp_us + TIMESTAMP_HOLD_US) {
+    at = 2 * ramp_us + TIMESTAMP_HOLD_US - at;
+  } else if (at >= ramp_us) {
+    return 1000;
+  }
+  int64_t progress = (int64_t)at * 1000 / ramp_us;
+  return progress * progress * (3000 - 2 * progress) / 1000000;
+}
+
+static uint32_t timestamp_error(uint32_t at, uint32_t reference_at) {
+  int32_t error = at - reference_at;
+  return error < 0 ? -error : error;
+}
+
+// Presses replayed through a key scanned once per frame and a reference key scanned every few microseconds;
+// actuations and releases are stamped on the polling tick, on the first frame past the threshold and interpolated
+static void replay_timestamps() {
+  struct key_config config = { 0 };
+  uint64_t error_sums[TIMESTAMP_METHODS_COUNT] = { 0 };
+  uint32_t max_errors[TIMESTAMP_METHODS_COUNT] = { 0 };
+  uint32_t events = 0;
+
+  config.hardware.magnet_polarity = SOUTH_POLE_FACING_DOWN;
+  config.deadzones.start_offset = 17;
+  config.deadzones.end_offset = 17;
+  config.actuation_distance = 128;
+  config.release_distance = 127;
+  init_keys_state(&soa_state, &config, 1);
+  init_keys_state(&reference_state, &config, 1);
+
+  uint32_t at = 0;
+  for (int frame = 0; frame < REPLAY_CALIBRATION_FRAMES; frame++, at += TIMESTAMP_FRAME_US) {
+    raw_values[0] = 1400;
+    update_keys_state(&soa_state, raw_values, &at, 1, 1);
+    update_keys_state(&reference_state, raw_values, &at, 1, 1);
+  }
+
+  for (int press = 0; press < TIMESTAMP_PRESSES; press++) {
+    uint32_t ramp_us = 4000 + press * 1733 % 16000;
+    // Start anywhere within a frame
+    uint32_t pressed_at = at + TIMESTAMP_REST_US + press * 379 % TIMESTAMP_FRAME_US;
+    uint32_t stamps[2][TIMESTAMP_METHODS_COUNT] = { 0 };
+    uint8_t previous_distance = soa_state.distance[0];
+
+    for (uint32_t end = at + TIMESTAMP_PRESS_US; at < end; at += TIMESTAMP_FINE_US) {
+      raw_values[0] = 1400 + timestamp_travel(at > pressed_at ? at - pressed_at : 0, ramp_us) * 12 / 10;
+      update_keys_state(&reference_state, raw_values, &at, 1, 0);
+      if (at % TIMESTAMP_FRAME_US != 0) {
+        continue;
+      }
+
+      update_keys_state(&soa_state, raw_values, &at, 1, 0);
+      uint8_t distance = soa_state.distance[0];
+      int edge = -1;
+      if (previous_distance < config.actuation_distance && distance >= config.actuation_distance) {
+        edge = 0;
+      } else if (previous_distance > config.release_distance && distance <= config.release_distance) {
+        edge = 1;
+      }
+      if (edge >= 0) {
+        uint32_t polled_at = (at + TIMESTAMP_POLL_US - 1) / TIMESTAMP_POLL_US * TIMESTAMP_POLL_US;
+        stamps[edge][TIMESTAMP_TICK] = polled_at / TIMESTAMP_TICK_US * TIMESTAMP_TICK_US;
+        stamps[edge][TIMESTAMP_FRAME] = at;
+      }
+      previous_distance = distance;
+    }
+    stamps[0][TIMESTAMP_INTERPOLATED] = soa_state.actuated_at[0];
+    stamps[1][TIMESTAMP_INTERPOLATED] = soa_state.released_at[0];
+
+    // The first press teaches the max distance
+    if (press == 0) {
+      continue;
+    }
+    uint32_t reference_stamps[2] = { reference_state.actuated_at[0], reference_state.released_at[0] };
+    for (int edge = 0; edge < 2; edge++) {
+      for (int method = 0; method < TIMESTAMP_METHODS_COUNT; method++) {
+        uint32_t error = timestamp_error(stamps[edge][method], reference_stamps[edge]);
+        error_sums[method] += error;
+        if (error > max_errors[method]) {
+          max_errors[method] = error;
+        }
+      }
+      events++;
+    }
+  }
+
+  ESP_LOGI(TAG, "timestamp replay, %" PRIu32 " events, error avg/max %" PRIu32 "/%" PRIu32 " us on the polling tick, "
+                "%" PRIu32 "/%" PRIu32 " us on the frame, %" PRIu32 "/%" PRIu32 " us interpolated",
+           events, (uint32_t)(error_sums[TIMESTAMP_TICK] / events), max_errors[TIMESTAMP_TICK],
+           (uint32_t)(error_sums[TIMESTAMP_FRAME] / events), max_errors[TIMESTAMP_FRAME],
+           (uint32_t)(error_sums[TIMESTAMP_INTERPOLATED] / events), max_errors[TIMESTAMP_INTERPOLATED]);
+}
+
+void benchmark_key_engine() {
+  const int key_counts[] = { KEYS_COUNT, 16, BENCHMARK_MAX_KEYS };
+
+  for (int i = 0; i < sizeof(key_counts) / sizeof(key_counts[0]); i++) {
+    reset_keys(key_counts[i]);
+    uint32_t aos_cycles = run_aos(key_counts[i]);
+    uint32_t soa_cycles = run_soa(key_counts[i], 0);
+    uint32_t tracked_cycles = run_soa(key_counts[i], 1);
+    ESP_LOGI(TAG, "%2d keys: %" PRIu32 " cycles/frame array of structs, %" PRIu32 " cycles/frame structure of arrays, %" PRIu32 " cycles/frame tracked",
+             key_counts[i], aos_cycles, soa_cycles, tracked_cycles);
+  }
+
+  replay_supply_sag();
+  replay_tracker();
+  replay_noise();
+  replay_drift();
+  replay_crosstalk();
+  replay_timestamps();
+}
+
+#else
+
+void benchmark_key_engine() {
+}
+
+#endif
@@ -0,0 +1,7 @@
+#pragma once
+
+/**
+ * @brief Measure key engine cycles per scan frame for growing key counts,
+ *        then replay synthetic sensor traces through the sample stages
+ */
+void benchmark_key_engine(void);
@@ -0,0 +1,70 @@
+#include "board.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "BOARD";
+
+struct board_adc_input {
+  adc_unit_t adc_unit;
+  adc_channel_t adc_channel;
+};
+
+#define BOARD_MUX_INITIALIZER(name, unit, channel) \
+  [MUX_##name] = { .adc_unit = unit, .adc_channel = channel },
+// One spare entry keeps the array non-empty on boards without multiplexers
+static const struct board_adc_input board_muxes[MUXES_COUNT + 1] = {
+  BOARD_MUXES(BOARD_MUX_INITIALIZER)
+};
+
+#define BOARD_KEY_INITIALIZER(name, unit, channel, polarity) \
+  [KEY_##name] = { .adc_unit = unit, .adc_channel = channel, .mux_address = BOARD_DIRECT, .magnet_polarity = polarity },
+#define BOARD_MUX_KEY_INITIALIZER(name, mux_name, address, polarity) \
+  [KEY_##name] = { .mux = MUX_##mux_name, .mux_address = address, .magnet_polarity = polarity },
+// ADC unit/channel of multiplexed keys are filled in from their multiplexer by board_init
+struct board_key board_keys[KEYS_COUNT] = {
+  BOARD_KEYS(BOARD_KEY_INITIALIZER)
+  BOARD_MUX_KEYS(BOARD_MUX_KEY_INITIALIZER)
+};
+
+#define BOARD_PATTERN_INITIALIZER(_name, adc_unit, adc_channel, ...) \
+  { .atten = ADC_ATTEN_DB_12, .channel = adc_channel, .unit = adc_unit, .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH },
+adc_digi_pattern_config_t board_adc_pattern[ADC_CHANNEL_COUNT] = {
+  BOARD_KEYS(BOARD_PATTERN_INITIALIZER)
+  BOARD_MUXES(BOARD_PATTERN_INITIALIZER)
+};
+struct board_input board_inputs_by_channel[MUX_ADDRESS_COUNT][BOARD_ADC_UNIT_SLOTS][BOARD_ADC_CHANNEL_SLOTS] = { 0 };
+
+static void add_input(uint8_t mux_address, adc_unit_t unit, adc_channel_t channel, struct board_input input) {
+  if (board_inputs_by_channel[mux_address][unit][channel].type != BOARD_INPUT_NONE) {
+    ESP_LOGE(TAG, "ADC unit %d channel %d is assigned twice at mux address %d", unit, channel, mux_address);
+  }
+  board_inputs_by_channel[mux_address][unit][channel] = input;
+}
+
+void board_init() {
+  memset(board_inputs_by_channel, 0, sizeof(board_inputs_by_channel));
+
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    struct board_input input = { .type = BOARD_INPUT_KEY, .index = i };
+    if (board_keys[i].mux_address == BOARD_DIRECT) {
+      // Direct keys are sampled on every scan step, whatever the multiplexer address
+      for (int address = 0; address < MUX_ADDRESS_COUNT; address++) {
+        add_input(address, board_keys[i].adc_unit, board_keys[i].adc_channel, input);
+      }
+    } else if (board_keys[i].mux_address < MUX_ADDRESS_COUNT && board_keys[i].mux < MUXES_COUNT) {
+      board_keys[i].adc_unit = board_muxes[board_keys[i].mux].adc_unit;
+      board_keys[i].adc_channel = board_muxes[board_keys[i].mux].adc_channel;
+      add_input(board_keys[i].mux_address, board_keys[i].adc_unit, board_keys[i].adc_channel, input);
+    } else {
+      ESP_LOGE(TAG, "key %d mux %d address %d is out of range", i, board_keys[i].mux, board_keys[i].mux_address);
+    }
+  }
+
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    if (board_keys[i].adc_unit == BOARD_BATTERY_ADC_UNIT && board_keys[i].adc_channel == BOARD_BATTERY_ADC_CHANNEL) {
+      ESP_LOGE(TAG, "key %d shares the battery ADC channel", i);
+    }
+  }
+
+  ESP_LOGI(TAG, "%d keys (%d behind %d muxes)", KEYS_COUNT, KEYS_COUNT - DIRECT_KEYS_COUNT, MUXES_COUNT);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "esp_adc/adc_continuous.h"
+#include <stdint.h>
+
+enum magnet_polarity {
+  NORTH_POLE_FACING_DOWN,
+  SOUTH_POLE_FACING_DOWN,
+};
+
+// Hall effect keys wired straight to an ADC channel, in key index order
+// KEY(name, adc unit, adc channel, magnet polarity)
+#define BOARD_KEYS(KEY)                                          \
+  KEY(RIGHT, ADC_UNIT_1, ADC_CHANNEL_3, NORTH_POLE_FACING_DOWN) \
+  KEY(LEFT, ADC_UNIT_1, ADC_CHANNEL_4, NORTH_POLE_FACING_DOWN)  \
+  KEY(DOWN, ADC_UNIT_1, ADC_CHANNEL_5, NORTH_POLE_FACING_DOWN)  \
+  KEY(UP, ADC_UNIT_1, ADC_CHANNEL_6, NORTH_POLE_FACING_DOWN)
+
+// Analog multiplexers (e.g. 74HC4067), all driven by the shared select lines below
+// MUX(name, adc unit, adc channel wired to the common output)
+#define BOARD_MUXES(MUX)
+
+// Hall effect keys behind a multiplexer, indexed after the direct keys
+// MUX_KEY(name, mux name, mux address, magnet polarity)
+#define BOARD_MUX_KEYS(MUX_KEY)
+
+// Multiplexer select GPIOs, least significant address bit first
+// MUX_SELECT(gpio)
+#define BOARD_MUX_SELECT_GPIOS(MUX_SELECT)
+
+// Time for a multiplexer output to settle after an address change
+#define BOARD_MUX_SETTLE_US 5
+
+// Battery voltage divider output, sampled on its own low-rate schedule outside the key scan pattern
+#define BOARD_BATTERY_ADC_UNIT ADC_UNIT_1
+#define BOARD_BATTERY_ADC_CHANNEL ADC_CHANNEL_0
+// The ADC sees the cell voltage divided by this ratio
+#define BOARD_BATTERY_DIVIDER 2
+// Hall sensors supplied straight from the cell, so their readings scale with its voltage; 0 behind a regulator
+#define BOARD_SENSOR_SUPPLY_FROM_BATTERY 1
+// Supply voltage key readings are normalized to, calibration holds over the discharge curve around it
+#define BOARD_SENSOR_SUPPLY_NOMINAL_MV 3700
+
+#define BOARD_KEY_ENUM(name, ...) KEY_##name,
+enum board_key_index {
+  BOARD_KEYS(BOARD_KEY_ENUM)
+  BOARD_MUX_KEYS(BOARD_KEY_ENUM)
+  KEYS_COUNT
+};
+
+#define BOARD_DIRECT_KEY_ENUM(name, ...) DIRECT_KEY_##name,
+enum board_direct_key_index {
+  BOARD_KEYS(BOARD_DIRECT_KEY_ENUM)
+  DIRECT_KEYS_COUNT
+};
+
+#define BOARD_MUX_ENUM(name, ...) MUX_##name,
+enum board_mux_index {
+  BOARD_MUXES(BOARD_MUX_ENUM)
+  MUXES_COUNT
+};
+
+#define BOARD_MUX_SELECT_ENUM(gpio) MUX_SELECT_GPIO_##gpio,
+enum board_mux_select_index {
+  BOARD_MUX_SELECT_GPIOS(BOARD_MUX_SELECT_ENUM)
+  MUX_SELECT_BITS
+};
+
+// Number of scan steps needed to visit every multiplexer address, 1 without multiplexers
+#define MUX_ADDRESS_COUNT (1 << MUX_SELECT_BITS)
+
+#define ADC_CHANNEL_COUNT (DIRECT_KEYS_COUNT + MUXES_COUNT)
+
+// One slot per value of the type2 unit/channel result fields, so the lookup needs no bounds check
+#define BOARD_ADC_UNIT_SLOTS 2
+#define BOARD_ADC_CHANNEL_SLOTS 8
+
+enum board_input_type {
+  BOARD_INPUT_NONE,
+  BOARD_INPUT_KEY,
+};
+
+struct board_input {
+  uint8_t type;
+  // Key index for BOARD_INPUT_KEY
+  uint8_t index;
+};
+
+#define BOARD_DIRECT 0xFF
+
+struct board_key {
+  // ADC channel of the key, or of its multiplexer output
+  adc_unit_t adc_unit;
+  adc_channel_t adc_channel;
+  // Multiplexer index and address, BOARD_DIRECT address for keys wired straight to the ADC
+  uint8_t mux;
+  uint8_t mux_address;
+  enum magnet_polarity magnet_polarity;
+};
+
+extern struct board_key board_keys[KEYS_COUNT];
+
+// ADC continuous pattern: direct keys, then multiplexers
+extern adc_digi_pattern_config_t board_adc_pattern[ADC_CHANNEL_COUNT];
+
+// Direct index from the multiplexer address and a conversion result's unit/channel to the input it samples
+extern struct board_input board_inputs_by_channel[MUX_ADDRESS_COUNT][BOARD_ADC_UNIT_SLOTS][BOARD_ADC_CHANNEL_SLOTS];
+
+/**
+ * @brief Build the channel lookup table from the board description
+ */
+void board_init(void);
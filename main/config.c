@@ -0,0 +1,160 @@
+#include "config.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "key_config.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+
+static const char *TAG = "CONFIG";
+
+#define READERS_CATCH_UP_TIMEOUT_MS 500
+
+struct key_config_defaults {
+  struct deadzones deadzones;
+  uint8_t actuation_distance;
+  uint8_t release_distance;
+  struct rapid_trigger rapid_trigger;
+};
+
+#define KEY_CONFIG_INITIALIZER(name, start_offset, end_offset, actuation, release, rt_enabled, rt_continuous, rt_actuation, rt_release) \
+  [KEY_##name] = {                                                                                                                    \
+    .deadzones = { start_offset, end_offset },                                                                                       \
+    .actuation_distance = actuation,                                                                                                 \
+    .release_distance = release,                                                                                                     \
+    .rapid_trigger = { rt_enabled, rt_continuous, rt_actuation, rt_release },                                                        \
+  },
+static const struct key_config_defaults key_config_defaults[KEYS_COUNT] = {
+  KEY_CONFIGS(KEY_CONFIG_INITIALIZER)
+};
+
+// The active buffer is only ever read; edits go to the spare one and are published by a pointer swap
+static struct keys_config buffers[2] = { 0 };
+static _Atomic(struct keys_config *) active_config = &buffers[0];
+static _Atomic uint32_t reader_versions[CONFIG_READERS_COUNT] = { 0 };
+
+// Serializes writers only, readers never take it
+static SemaphoreHandle_t edit_lock = NULL;
+static struct keys_config *editing = NULL;
+
+void config_load_defaults(struct keys_config *config) {
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    config->keys[i].hardware.adc_unit = board_keys[i].adc_unit;
+    config->keys[i].hardware.adc_channel = board_keys[i].adc_channel;
+    config->keys[i].hardware.magnet_polarity = board_keys[i].magnet_polarity;
+
+    config->keys[i].deadzones = key_config_defaults[i].deadzones;
+    config->keys[i].actuation_distance = key_config_defaults[i].actuation_distance;
+    config->keys[i].release_distance = key_config_defaults[i].release_distance;
+    config->keys[i].rapid_trigger = key_config_defaults[i].rapid_trigger;
+  }
+  memcpy(config->keymap, default_keymap, sizeof(config->keymap));
+}
+
+void config_init() {
+  struct keys_config *config = &buffers[0];
+
+  config->version = 1;
+  config_load_defaults(config);
+
+  for (int i = 0; i < CONFIG_READERS_COUNT; i++) {
+    atomic_store(&reader_versions[i], config->version);
+  }
+  atomic_store(&active_config, config);
+
+  if (edit_lock == NULL) {
+    edit_lock = xSemaphoreCreateMutex();
+  }
+}
+
+const struct keys_config *config_acquire(enum config_reader reader) {
+  const struct keys_config *config = atomic_load_explicit(&active_config, memory_order_acquire);
+  atomic_store_explicit(&reader_versions[reader], config->version, memory_order_release);
+  return config;
+}
+
+void config_snapshot(struct keys_config *snapshot) {
+  // A buffer is only written again after another one got published, so a copy taken while the
+  // same buffer stayed active on the same version is consistent
+  while (1) {
+    const struct keys_config *config = atomic_load_explicit(&active_config, memory_order_acquire);
+    uint32_t version = config->version;
+    memcpy(snapshot, config, sizeof(struct keys_config));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&active_config, memory_order_relaxed) == config && config->version == version) {
+      return;
+    }
+  }
+}
+
+bool config_is_valid(const struct keys_config *config) {
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    const struct key_config *key = &config->keys[i];
+    // A key actuating at 0 never releases, one releasing at or above its actuation never stays pressed
+    if (key->actuation_distance == 0 || key->release_distance >= key->actuation_distance) {
+      return false;
+    }
+    if (key->rapid_trigger.is_enabled > 1 || key->rapid_trigger.is_continuous > 1) {
+      return false;
+    }
+    for (int layer = 0; layer < LAYERS_COUNT; layer++) {
+      if (!keymap_is_valid_action(config->keymap[layer][i])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool readers_caught_up(uint32_t version) {
+  for (int i = 0; i < CONFIG_READERS_COUNT; i++) {
+    if (atomic_load_explicit(&reader_versions[i], memory_order_acquire) != version) {
+      return false;
+    }
+  }
+  return true;
+}
+
+struct keys_config *config_begin_edit() {
+  xSemaphoreTake(edit_lock, portMAX_DELAY);
+
+  struct keys_config *active = atomic_load(&active_config);
+  struct keys_config *spare = active == &buffers[0] ? &buffers[1] : &buffers[0];
+
+  // A reader that acquired the previous version may still be reading the spare buffer
+  TickType_t started_at = xTaskGetTickCount();
+  while (!readers_caught_up(active->version)) {
+    if (xTaskGetTickCount() - started_at > pdMS_TO_TICKS(READERS_CATCH_UP_TIMEOUT_MS)) {
+      ESP_LOGW(TAG, "readers still on version %" PRIu32, active->version - 1);
+      xSemaphoreGive(edit_lock);
+      return NULL;
+    }
+    vTaskDelay(1);
+  }
+
+  memcpy(spare, active, sizeof(struct keys_config));
+  editing = spare;
+  return spare;
+}
+
+void config_publish() {
+  struct keys_config *active = atomic_load(&active_config);
+
+  editing->version = active->version + 1;
+  atomic_store_explicit(&active_config, editing, memory_order_release);
+  ESP_LOGI(TAG, "published version %" PRIu32, editing->version);
+
+  editing = NULL;
+  xSemaphoreGive(edit_lock);
+}
+
+void config_cancel_edit() {
+  editing = NULL;
+  xSemaphoreGive(edit_lock);
+}
+
+uint32_t config_get_version() {
+  return atomic_load(&active_config)->version;
+}
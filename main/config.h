@@ -0,0 +1,66 @@
+#pragma once
+
+#include "keymap.h"
+#include "main.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Tasks reading the configuration; each one reports the version it runs on
+enum config_reader {
+  CONFIG_READER_SCAN,
+  CONFIG_READER_KEYS,
+  CONFIG_READERS_COUNT,
+};
+
+struct keys_config {
+  // Monotonically increasing, bumped on every publish
+  uint32_t version;
+  struct key_config keys[KEYS_COUNT];
+  uint16_t keymap[LAYERS_COUNT][KEYS_COUNT];
+};
+
+/**
+ * @brief Load the build-time defaults into the active configuration
+ */
+void config_init(void);
+
+/**
+ * @brief Fill a configuration with the build-time defaults, keeping its version
+ */
+void config_load_defaults(struct keys_config *config);
+
+/**
+ * @brief Get the active configuration, to be called once per frame by each reader
+ * @note Lock-free; the returned buffer stays valid until the reader's next call
+ */
+const struct keys_config *config_acquire(enum config_reader reader);
+
+/**
+ * @brief Copy the active configuration, for tasks that only read it now and then
+ * @note Lock-free and never waits on readers, unlike config_begin_edit
+ */
+void config_snapshot(struct keys_config *snapshot);
+
+/**
+ * @brief Check every key can both actuate and release, and every keymap action is known
+ */
+bool config_is_valid(const struct keys_config *config);
+
+/**
+ * @brief Get a writable copy of the active configuration
+ * @note Waits for every reader to leave the spare buffer, never blocks readers
+ * @return Spare buffer to edit, NULL if a reader did not catch up in time
+ */
+struct keys_config *config_begin_edit(void);
+
+/**
+ * @brief Atomically make the buffer returned by config_begin_edit the active one
+ */
+void config_publish(void);
+
+/**
+ * @brief Drop the edits made since config_begin_edit
+ */
+void config_cancel_edit(void);
+
+uint32_t config_get_version(void);
@@ -0,0 +1,365 @@
+#include "crosstalk.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "main.h"
+#include "nvs.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "CROSSTALK";
+
+#define CROSSTALK_NAMESPACE "crosstalk"
+#define CROSSTALK_MATRIX_KEY "matrix"
+#define CROSSTALK_MAGIC 0x4C435854 // "LCXT"
+// Bump whenever struct crosstalk_blob changes, older blobs are then ignored
+#define CROSSTALK_FORMAT_VERSION 1
+// Time given to the scan task to leave the calibration, a few slow scans
+#define CROSSTALK_STOP_TIMEOUT_MS 500
+
+struct crosstalk_matrix {
+  // Bumped on every publish, acknowledged by the scan task
+  uint32_t version;
+  uint8_t calibrated_keys;
+  // Row by affected key, column by pressed key, zero on the diagonal
+  int16_t coefficients[KEYS_COUNT][KEYS_COUNT];
+};
+
+// On-flash layout of the matrix, read and written as a single NVS blob like the profiles
+struct __attribute__((packed)) crosstalk_blob {
+  uint32_t magic;
+  uint16_t format_version;
+  uint8_t keys_count;
+  uint8_t calibrated_keys;
+  int16_t coefficients[KEYS_COUNT][KEYS_COUNT];
+  // CRC-32 of every field above
+  uint32_t crc;
+};
+
+// The active one is read by the scan task every frame; the spare one is only rewritten once the scan task
+// acknowledged the active version, like the configuration buffers
+static struct crosstalk_matrix matrices[2] = { 0 };
+static _Atomic(struct crosstalk_matrix *) active_matrix = &matrices[0];
+static _Atomic uint32_t reader_version = 0;
+
+// Calibration sums, only touched by the scan task until it reports CROSSTALK_STOPPED
+struct crosstalk_calibration {
+  uint32_t rest_sums[KEYS_COUNT];
+  uint32_t rest_frames;
+  uint16_t rest_mv[KEYS_COUNT];
+  int64_t squared_travels[KEYS_COUNT];
+  int64_t cross_products[KEYS_COUNT][KEYS_COUNT];
+  uint32_t samples[KEYS_COUNT];
+};
+
+static struct crosstalk_calibration calibration;
+static _Atomic uint8_t state = CROSSTALK_IDLE;
+static struct crosstalk_blob blob = { 0 };
+
+static uint32_t blob_crc(const struct crosstalk_blob *matrix_blob) {
+  return esp_rom_crc32_le(0, (const uint8_t *)matrix_blob, offsetof(struct crosstalk_blob, crc));
+}
+
+// Spare buffer to fill, NULL if the scan task may still be reading it from before the last publish
+static struct crosstalk_matrix *begin_matrix_edit() {
+  struct crosstalk_matrix *active = atomic_load(&active_matrix);
+
+  TickType_t started_at = xTaskGetTickCount();
+  while (atomic_load_explicit(&reader_version, memory_order_acquire) != active->version) {
+    if (xTaskGetTickCount() - started_at > pdMS_TO_TICKS(CROSSTALK_STOP_TIMEOUT_MS)) {
+      ESP_LOGW(TAG, "scan task still on matrix version %" PRIu32, active->version - 1);
+      return NULL;
+    }
+    vTaskDelay(1);
+  }
+
+  struct crosstalk_matrix *spare = active == &matrices[0] ? &matrices[1] : &matrices[0];
+  memset(spare, 0, sizeof(*spare));
+  return spare;
+}
+
+static void publish_matrix(struct crosstalk_matrix *matrix) {
+  matrix->version = atomic_load(&active_matrix)->version + 1;
+  atomic_store_explicit(&active_matrix, matrix, memory_order_release);
+}
+
+static esp_err_t store_matrix(const struct crosstalk_matrix *matrix) {
+  nvs_handle_t handle;
+  esp_err_t ret = nvs_open(CROSSTALK_NAMESPACE, NVS_READWRITE, &handle);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "failed to open NVS: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  if (matrix != NULL) {
+    blob.magic = CROSSTALK_MAGIC;
+    blob.format_version = CROSSTALK_FORMAT_VERSION;
+    blob.keys_count = KEYS_COUNT;
+    blob.calibrated_keys = matrix->calibrated_keys;
+    memcpy(blob.coefficients, matrix->coefficients, sizeof(blob.coefficients));
+    blob.crc = blob_crc(&blob);
+    ret = nvs_set_blob(handle, CROSSTALK_MATRIX_KEY, &blob, sizeof(blob));
+  } else {
+    ret = nvs_erase_key(handle, CROSSTALK_MATRIX_KEY);
+  }
+  if (ret == ESP_ERR_NVS_NOT_FOUND) {
+    ret = ESP_OK;
+  }
+  if (ret == ESP_OK) {
+    ret = nvs_commit(handle);
+  }
+  nvs_close(handle);
+
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "failed to store the matrix: %s", esp_err_to_name(ret));
+  }
+  return ret;
+}
+
+void crosstalk_init() {
+  nvs_handle_t handle;
+  if (nvs_open(CROSSTALK_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return;
+  }
+
+  size_t length = sizeof(blob);
+  esp_err_t ret = nvs_get_blob(handle, CROSSTALK_MATRIX_KEY, &blob, &length);
+  nvs_close(handle);
+  if (ret != ESP_OK) {
+    return;
+  }
+
+  // Checked like a profile, then every coefficient against the bound a calibration clips to
+  if (length != sizeof(blob) || blob.magic != CROSSTALK_MAGIC || blob.format_version != CROSSTALK_FORMAT_VERSION ||
+      blob.keys_count != KEYS_COUNT) {
+    ESP_LOGW(TAG, "stored matrix has an incompatible layout");
+    return;
+  }
+  if (blob.crc != blob_crc(&blob)) {
+    ESP_LOGW(TAG, "stored matrix is corrupted");
+    return;
+  }
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    for (int j = 0; j < KEYS_COUNT; j++) {
+      if (abs(blob.coefficients[i][j]) > CROSSTALK_MAX_COEFFICIENT || (i == j && blob.coefficients[i][j] != 0)) {
+        ESP_LOGW(TAG, "stored matrix has out of range coefficients");
+        return;
+      }
+    }
+  }
+
+  // Before the scan task starts, nothing reads the spare buffer
+  struct crosstalk_matrix *matrix = begin_matrix_edit();
+  matrix->calibrated_keys = blob.calibrated_keys;
+  memcpy(matrix->coefficients, blob.coefficients, sizeof(matrix->coefficients));
+  publish_matrix(matrix);
+  ESP_LOGI(TAG, "matrix loaded, %d keys calibrated", matrix->calibrated_keys);
+}
+
+static void observe_rest(const uint16_t samples[KEYS_COUNT]) {
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    calibration.rest_sums[i] += samples[i];
+  }
+  if (++calibration.rest_frames < CROSSTALK_REST_FRAMES) {
+    return;
+  }
+
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    calibration.rest_mv[i] = calibration.rest_sums[i] / calibration.rest_frames;
+  }
+  atomic_store(&state, CROSSTALK_MEASURE);
+  ESP_LOGI(TAG, "rest readings taken, press each key alone");
+}
+
+// Least squares fit of each other key's shift against the travel of the only key pressed
+static void observe_press(const uint16_t samples[KEYS_COUNT]) {
+  int32_t travels[KEYS_COUNT];
+  int pressed = 0;
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    travels[i] = (int32_t)samples[i] - calibration.rest_mv[i];
+    if (abs(travels[i]) > abs(travels[pressed])) {
+      pressed = i;
+    }
+  }
+
+  int32_t pressed_travel = abs(travels[pressed]);
+  if (pressed_travel < CROSSTALK_PRESS_MIN_MV) {
+    return;
+  }
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    if (i != pressed && abs(travels[i]) * CROSSTALK_ALONE_RATIO > pressed_travel) {
+      return;
+    }
+  }
+
+  calibration.squared_travels[pressed] += (int64_t)travels[pressed] * travels[pressed];
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    calibration.cross_products[pressed][i] += (int64_t)travels[pressed] * travels[i];
+  }
+  if (++calibration.samples[pressed] == CROSSTALK_MIN_SAMPLES) {
+    ESP_LOGI(TAG, "key %d calibrated", pressed);
+  }
+}
+
+void crosstalk_correct(uint16_t samples[KEYS_COUNT], const struct keys_state *engine_state) {
+  // Acknowledged every frame, calibrating or not, so a publish never waits on a scan task that is not correcting
+  const struct crosstalk_matrix *matrix = atomic_load_explicit(&active_matrix, memory_order_acquire);
+  atomic_store_explicit(&reader_version, matrix->version, memory_order_release);
+
+  switch (atomic_load_explicit(&state, memory_order_acquire)) {
+  case CROSSTALK_IDLE:
+    break;
+  case CROSSTALK_REST:
+    observe_rest(samples);
+    return;
+  case CROSSTALK_MEASURE:
+    observe_press(samples);
+    return;
+  case CROSSTALK_STOPPING:
+    atomic_store_explicit(&state, CROSSTALK_STOPPED, memory_order_release);
+    return;
+  default:
+    return;
+  }
+
+#if CROSSTALK_CORRECTION
+  if (matrix->calibrated_keys == 0) {
+    return;
+  }
+
+  // Travel from the idle value the key engine keeps tracking, so supply sag and drift on a released
+  // key never read as travel; keys not calibrated yet have none
+  int32_t travels[KEYS_COUNT];
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    int32_t idle_mv = engine_state->is_inverted[i] ? ADC_VREF - engine_state->idle_value[i] : engine_state->idle_value[i];
+    travels[i] = engine_state->idle_value[i] != 0 ? (int32_t)samples[i] - idle_mv : 0;
+  }
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    int32_t error = 0;
+    for (int j = 0; j < KEYS_COUNT; j++) {
+      error += matrix->coefficients[i][j] * travels[j];
+    }
+    int32_t corrected = (int32_t)samples[i] - (error >> CROSSTALK_COEFFICIENT_SHIFT);
+    samples[i] = corrected < 0 ? 0 : (corrected > ADC_VREF ? ADC_VREF : corrected);
+  }
+#endif
+}
+
+esp_err_t crosstalk_start_calibration() {
+  // Parked in CROSSTALK_STOPPED, which the scan task ignores, while the sums are reset
+  uint8_t expected = CROSSTALK_IDLE;
+  if (!atomic_compare_exchange_strong(&state, &expected, CROSSTALK_STOPPED)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  memset(&calibration, 0, sizeof(calibration));
+  atomic_store_explicit(&state, CROSSTALK_REST, memory_order_release);
+  ESP_LOGI(TAG, "calibration started, release every key");
+  return ESP_OK;
+}
+
+// Take the calibration back from the scan task, its sums are then stable
+static esp_err_t stop_calibration() {
+  uint8_t current = atomic_load(&state);
+  if (current != CROSSTALK_REST && current != CROSSTALK_MEASURE) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  atomic_store(&state, CROSSTALK_STOPPING);
+
+  TickType_t started_at = xTaskGetTickCount();
+  while (atomic_load_explicit(&state, memory_order_acquire) != CROSSTALK_STOPPED) {
+    if (xTaskGetTickCount() - started_at > pdMS_TO_TICKS(CROSSTALK_STOP_TIMEOUT_MS)) {
+      atomic_store(&state, CROSSTALK_IDLE);
+      return ESP_ERR_TIMEOUT;
+    }
+    vTaskDelay(1);
+  }
+  return ESP_OK;
+}
+
+esp_err_t crosstalk_finish_calibration() {
+  bool has_rest = atomic_load(&state) == CROSSTALK_MEASURE;
+  esp_err_t ret = stop_calibration();
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  if (!has_rest) {
+    atomic_store(&state, CROSSTALK_IDLE);
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  struct crosstalk_matrix *matrix = begin_matrix_edit();
+  if (matrix == NULL) {
+    atomic_store(&state, CROSSTALK_IDLE);
+    return ESP_ERR_TIMEOUT;
+  }
+  for (int pressed = 0; pressed < KEYS_COUNT; pressed++) {
+    if (calibration.samples[pressed] < CROSSTALK_MIN_SAMPLES) {
+      continue;
+    }
+    matrix->calibrated_keys++;
+
+    for (int affected = 0; affected < KEYS_COUNT; affected++) {
+      if (affected == pressed) {
+        continue;
+      }
+      int64_t coefficient = (calibration.cross_products[pressed][affected] << CROSSTALK_COEFFICIENT_SHIFT) /
+                            calibration.squared_travels[pressed];
+      if (coefficient > CROSSTALK_MAX_COEFFICIENT) {
+        coefficient = CROSSTALK_MAX_COEFFICIENT;
+      } else if (coefficient < -CROSSTALK_MAX_COEFFICIENT) {
+        coefficient = -CROSSTALK_MAX_COEFFICIENT;
+      }
+      matrix->coefficients[affected][pressed] = coefficient;
+    }
+  }
+
+  publish_matrix(matrix);
+  atomic_store(&state, CROSSTALK_IDLE);
+  ESP_LOGI(TAG, "calibration finished, %d of %d keys calibrated", matrix->calibrated_keys, KEYS_COUNT);
+
+  return store_matrix(matrix);
+}
+
+void crosstalk_cancel_calibration() {
+  if (stop_calibration() == ESP_OK) {
+    atomic_store(&state, CROSSTALK_IDLE);
+    ESP_LOGI(TAG, "calibration cancelled");
+  }
+}
+
+esp_err_t crosstalk_clear() {
+  if (atomic_load(&state) != CROSSTALK_IDLE) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  struct crosstalk_matrix *matrix = begin_matrix_edit();
+  if (matrix == NULL) {
+    return ESP_ERR_TIMEOUT;
+  }
+  publish_matrix(matrix);
+  return store_matrix(NULL);
+}
+
+enum crosstalk_state crosstalk_get_state() {
+  return atomic_load(&state);
+}
+
+uint8_t crosstalk_get_calibrated_keys() {
+  if (atomic_load(&state) == CROSSTALK_IDLE) {
+    return atomic_load(&active_matrix)->calibrated_keys;
+  }
+
+  uint8_t count = 0;
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    count += calibration.samples[i] >= CROSSTALK_MIN_SAMPLES;
+  }
+  return count;
+}
+
+int16_t crosstalk_get_coefficient(uint8_t affected_key, uint8_t pressed_key) {
+  return atomic_load(&active_matrix)->coefficients[affected_key][pressed_key];
+}
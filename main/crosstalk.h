@@ -0,0 +1,72 @@
+#pragma once
+
+#include "board.h"
+#include "esp_err.h"
+#include "main.h"
+#include <stdint.h>
+
+// Set to 0 to feed key samples to the key engine without crosstalk correction
+#define CROSSTALK_CORRECTION 1
+// Coefficients in 1 / (1 << shift) mV of error per mV of travel of the pressed key
+#define CROSSTALK_COEFFICIENT_SHIFT 12
+// Coefficients are clipped to +-1/4, anything larger is a wiring or calibration fault
+#define CROSSTALK_MAX_COEFFICIENT (1 << (CROSSTALK_COEFFICIENT_SHIFT - 2))
+// Frames averaged into the rest reading of each key when a calibration starts, every key released
+#define CROSSTALK_REST_FRAMES 500
+// A key counts as pressed alone past this travel, with every other key under 1 / ratio of it
+#define CROSSTALK_PRESS_MIN_MV 300
+#define CROSSTALK_ALONE_RATIO 4
+// Frames pressed alone needed before a key's coefficients are derived
+#define CROSSTALK_MIN_SAMPLES 200
+
+enum crosstalk_state {
+  CROSSTALK_IDLE,
+  // Every key released while their rest readings are taken
+  CROSSTALK_REST,
+  // Each key pressed alone, in any order, until finished
+  CROSSTALK_MEASURE,
+  CROSSTALK_STOPPING,
+  CROSSTALK_STOPPED,
+};
+
+/**
+ * @brief Load the stored correction matrix, none until a calibration is finished
+ */
+void crosstalk_init(void);
+
+/**
+ * @brief Correct a scan frame in place, called by the scan task before the key engine
+ *        While calibrating, samples are gathered and passed through uncorrected
+ * @param engine_state Key engine state, travel is measured from its tracked idle values
+ */
+void crosstalk_correct(uint16_t samples[KEYS_COUNT], const struct keys_state *engine_state);
+
+/**
+ * @brief Start a calibration, rest readings first then each key pressed alone
+ */
+esp_err_t crosstalk_start_calibration(void);
+
+/**
+ * @brief Derive the matrix from the keys pressed so far, then store and apply it
+ * @note Keys never pressed alone get no correction from their travel
+ */
+esp_err_t crosstalk_finish_calibration(void);
+
+void crosstalk_cancel_calibration(void);
+
+/**
+ * @brief Remove the stored matrix and stop correcting
+ */
+esp_err_t crosstalk_clear(void);
+
+enum crosstalk_state crosstalk_get_state(void);
+
+/**
+ * @brief Number of keys pressed alone long enough, during a calibration, or covered by the matrix otherwise
+ */
+uint8_t crosstalk_get_calibrated_keys(void);
+
+/**
+ * @brief Error on a key per mV of travel of another, in 1 / (1 << CROSSTALK_COEFFICIENT_SHIFT)
+ */
+int16_t crosstalk_get_coefficient(uint8_t affected_key, uint8_t pressed_key);
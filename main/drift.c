@@ -0,0 +1,227 @@
+#include "drift.h"
+#include "driver/temperature_sensor.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "DRIFT";
+
+// Plateaus confirmed in one window, with the bounds they were taken against
+struct drift_window {
+  // Mean normalized value of the lowest rest plateau and mean travel of the highest bottom-out one, 0 when none
+  uint16_t idle_levels[KEYS_COUNT];
+  uint16_t bottom_levels[KEYS_COUNT];
+  uint16_t idle_values[KEYS_COUNT];
+  uint16_t max_distances[KEYS_COUNT];
+};
+
+// Corrections relative to the bounds of the window, so fast changes made by the key engine meanwhile are kept
+struct drift_update {
+  int16_t idle_deltas[KEYS_COUNT];
+  int16_t max_distance_deltas[KEYS_COUNT];
+};
+
+// Scan task side
+static struct drift_window window = { 0 };
+static uint32_t window_frames = 0;
+// A reading held still, restarted whenever it moves more than DRIFT_PLATEAU_MV from where it started
+struct plateau {
+  uint16_t start;
+  uint16_t run;
+  uint32_t sum;
+  uint16_t count;
+};
+
+static struct plateau idle_plateaus[KEYS_COUNT] = { 0 };
+static struct plateau bottom_plateaus[KEYS_COUNT] = { 0 };
+
+static QueueHandle_t window_queue = NULL;
+
+// A window comes every second and the scan task applies an update within a frame of its publish,
+// so alternating between two buffers never writes the one being applied
+static struct drift_update updates[2];
+static uint8_t next_update = 0;
+static _Atomic(struct drift_update *) pending_update = NULL;
+
+static temperature_sensor_handle_t temperature_sensor = NULL;
+static float settled_temperature = 0;
+static bool is_settling = false;
+
+static int16_t bounded_step(int32_t delta, int32_t step) {
+  if (delta > step) {
+    return step;
+  }
+  return delta < -step ? -step : delta;
+}
+
+static bool read_temperature(float *temperature) {
+  if (temperature_sensor == NULL) {
+    return false;
+  }
+  return temperature_sensor_get_celsius(temperature_sensor, temperature) == ESP_OK;
+}
+
+static void compute_update(const struct drift_window *observed, struct drift_update *update) {
+  float temperature = 0;
+  if (read_temperature(&temperature) && !is_settling &&
+      (temperature > settled_temperature + DRIFT_TEMPERATURE_DELTA_C ||
+       temperature < settled_temperature - DRIFT_TEMPERATURE_DELTA_C)) {
+    ESP_LOGI(TAG, "temperature moved from %.1f to %.1f C, adapting faster", settled_temperature, temperature);
+    is_settling = true;
+  }
+  int gain = is_settling ? DRIFT_TEMPERATURE_STEP_GAIN : 1;
+
+  bool is_settled = true;
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    update->idle_deltas[i] = 0;
+    update->max_distance_deltas[i] = 0;
+
+    if (observed->idle_levels[i] != 0) {
+      int32_t target = observed->idle_levels[i];
+      int32_t delta = target - observed->idle_values[i];
+      update->idle_deltas[i] = bounded_step(delta, DRIFT_IDLE_STEP_MV * gain);
+      is_settled &= update->idle_deltas[i] == delta;
+    }
+
+    if (observed->bottom_levels[i] != 0) {
+      int32_t target = observed->bottom_levels[i];
+      if (target < DRIFT_MIN_MAX_DISTANCE) {
+        target = DRIFT_MIN_MAX_DISTANCE;
+      }
+      int32_t delta = target - observed->max_distances[i];
+      update->max_distance_deltas[i] = bounded_step(delta, DRIFT_MAX_DISTANCE_STEP_MV * gain);
+      is_settled &= update->max_distance_deltas[i] == delta;
+    }
+  }
+
+  if (is_settling && is_settled) {
+    ESP_LOGI(TAG, "calibration settled at %.1f C", temperature);
+    is_settling = false;
+  }
+  if (!is_settling && temperature_sensor != NULL) {
+    settled_temperature = temperature;
+  }
+}
+
+static void drift_task(void *pvParameters) {
+  static struct drift_window observed;
+  while (1) {
+    xQueueReceive(window_queue, &observed, portMAX_DELAY);
+
+    // Skip this window rather than write the buffer the scan task may not have applied yet
+    if (atomic_load_explicit(&pending_update, memory_order_acquire) != NULL) {
+      continue;
+    }
+    struct drift_update *update = &updates[next_update];
+    compute_update(&observed, update);
+    next_update ^= 1;
+    atomic_store_explicit(&pending_update, update, memory_order_release);
+  }
+}
+
+void drift_init() {
+#if DRIFT_TRACKING
+#if DRIFT_USE_TEMPERATURE
+  temperature_sensor_config_t temperature_config = TEMPERATURE_SENSOR_CONFIG_DEFAULT(-10, 80);
+  esp_err_t ret = temperature_sensor_install(&temperature_config, &temperature_sensor);
+  if (ret == ESP_OK) {
+    ret = temperature_sensor_enable(temperature_sensor);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "no temperature sensor, adapting at the base rate: %s", esp_err_to_name(ret));
+    temperature_sensor = NULL;
+  } else {
+    read_temperature(&settled_temperature);
+  }
+#endif
+
+  window_queue = xQueueCreate(1, sizeof(struct drift_window));
+  xTaskCreate(drift_task, "drift_task", 3072, NULL, 2, NULL);
+#endif
+}
+
+// Mean of the confirmed samples taken since the last call, 0 when too few to be trusted
+static uint16_t take_plateau_level(struct plateau *plateau) {
+  uint16_t level = plateau->count >= DRIFT_MIN_SAMPLES ? plateau->sum / plateau->count : 0;
+  plateau->sum = 0;
+  plateau->count = 0;
+  return level;
+}
+
+// Returns the level of a plateau that just ended, 0 while it goes on
+static uint16_t follow_plateau(struct plateau *plateau, bool is_in_range, uint16_t value) {
+  if (is_in_range && plateau->run > 0 && abs((int32_t)value - plateau->start) <= DRIFT_PLATEAU_MV) {
+    if (plateau->run < DRIFT_CONFIRM_FRAMES) {
+      plateau->run++;
+    } else {
+      plateau->sum += value;
+      plateau->count++;
+    }
+    return 0;
+  }
+
+  uint16_t level = take_plateau_level(plateau);
+  plateau->run = is_in_range;
+  plateau->start = value;
+  return level;
+}
+
+static void keep_lowest(uint16_t *level, uint16_t candidate) {
+  if (candidate != 0 && (*level == 0 || candidate < *level)) {
+    *level = candidate;
+  }
+}
+
+static void keep_highest(uint16_t *level, uint16_t candidate) {
+  if (candidate > *level) {
+    *level = candidate;
+  }
+}
+
+void drift_observe(const struct keys_state *state, int count, uint32_t sampled_keys) {
+#if DRIFT_TRACKING
+  for (int i = 0; i < count; i++) {
+    if (!(sampled_keys & (1 << i))) {
+      continue;
+    }
+    // Split at half the max distance, which stays right enough however far the bounds have drifted
+    uint16_t travel = state->normalized_value[i] > state->idle_value[i] ? state->normalized_value[i] - state->idle_value[i] : 0;
+    bool is_deep = travel * 2 >= state->max_distance[i];
+    keep_lowest(&window.idle_levels[i], follow_plateau(&idle_plateaus[i], !is_deep, state->normalized_value[i]));
+    keep_highest(&window.bottom_levels[i], follow_plateau(&bottom_plateaus[i], is_deep, travel));
+  }
+
+  if (++window_frames < DRIFT_WINDOW_FRAMES) {
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    // Plateaus still held carry on into the next window
+    keep_lowest(&window.idle_levels[i], take_plateau_level(&idle_plateaus[i]));
+    keep_highest(&window.bottom_levels[i], take_plateau_level(&bottom_plateaus[i]));
+    window.idle_values[i] = state->idle_value[i];
+    window.max_distances[i] = state->max_distance[i];
+  }
+  xQueueOverwrite(window_queue, &window);
+  memset(&window, 0, sizeof(window));
+  window_frames = 0;
+#endif
+}
+
+void drift_apply(struct keys_state *state, int count) {
+#if DRIFT_TRACKING
+  struct drift_update *update = atomic_exchange_explicit(&pending_update, NULL, memory_order_acquire);
+  if (update == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    set_key_calibration(state, i, state->idle_value[i] + update->idle_deltas[i],
+                        state->max_distance[i] + update->max_distance_deltas[i]);
+  }
+#endif
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "main.h"
+#include <stdint.h>
+
+// Set to 0 to leave idle values and max distances to the key engine's own fast tracking
+#define DRIFT_TRACKING 1
+// Set to 0 to adapt at the base rate whatever the chip temperature
+#define DRIFT_USE_TEMPERATURE 1
+// Processed frames gathered into each observation handed to the drift task
+#define DRIFT_WINDOW_FRAMES 1000
+// Frames a key must hold still on a plateau before its samples are trusted
+#define DRIFT_CONFIRM_FRAMES 200
+// A key is on a plateau while its reading stays this close to where the plateau started, in mV.
+// Rest is the lowest plateau of a window in the first half of the max distance, bottom-out the highest one
+// past it; neither relies on the bounds being right, a key resting part way for a whole window pulls a
+// bound by one step at worst
+#define DRIFT_PLATEAU_MV 16
+// Confirmed samples a plateau needs before a bound is adapted from it
+#define DRIFT_MIN_SAMPLES 100
+// Largest change per window of the idle value and max distance, in mV
+#define DRIFT_IDLE_STEP_MV 1
+#define DRIFT_MAX_DISTANCE_STEP_MV 2
+// Max distance never adapted below this, in mV
+#define DRIFT_MIN_MAX_DISTANCE 100
+// Temperature change, in degrees, after which the steps are multiplied until both bounds settle
+#define DRIFT_TEMPERATURE_DELTA_C 2
+#define DRIFT_TEMPERATURE_STEP_GAIN 4
+
+void drift_init(void);
+
+/**
+ * @brief Gather confirmed idle and bottom-out samples of a processed frame, called by the scan task
+ * @param sampled_keys Bitmask of the keys sampled in this frame, only those are observed
+ */
+void drift_observe(const struct keys_state *state, int count, uint32_t sampled_keys);
+
+/**
+ * @brief Apply the latest calibration update published by the drift task, all keys at once, between two frames
+ */
+void drift_apply(struct keys_state *state, int count);
@@ -109,4 +109,18 @@ void esp_hidd_send_keyboard_value(uint16_t conn_id, key_mask_t special_key_mask,
   hid_dev_send_report(hidd_le_env.gatt_if, conn_id,
                       HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT, HID_KEYBOARD_IN_RPT_LEN, buffer);
   return;
-}
\ No newline at end of file
+}
+void esp_hidd_send_vendor_value(uint16_t conn_id, const uint8_t *data, uint8_t length) {
+  if (length > HID_VENDOR_IN_RPT_LEN) {
+    ESP_LOGE(HID_LE_PRF_TAG, "%s(), the vendor report should not be more than %d bytes", __func__, HID_VENDOR_IN_RPT_LEN);
+    return;
+  }
+
+  // Input reports have a fixed length, the remainder is zero padded
+  uint8_t buffer[HID_VENDOR_IN_RPT_LEN] = { 0 };
+  memcpy(buffer, data, length);
+
+  hid_dev_send_report(hidd_le_env.gatt_if, conn_id,
+                      HID_RPT_ID_VENDOR_IN, HID_REPORT_TYPE_INPUT, HID_VENDOR_IN_RPT_LEN, buffer);
+  return;
+}
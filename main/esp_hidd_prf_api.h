@@ -52,6 +52,10 @@ typedef enum {
 #define RIGHT_ALT_KEY_MASK (1 << 6)
 #define RIGHT_GUI_KEY_MASK (1 << 7)
 
+// HID vendor report lengths
+#define HID_VENDOR_OUT_RPT_LEN 127
+#define HID_VENDOR_IN_RPT_LEN 32
+
 typedef uint8_t key_mask_t;
 /**
  * @brief HIDD callback parameters union
@@ -78,6 +82,8 @@ typedef union {
   struct hidd_connect_evt_param {
     uint16_t conn_id;
     esp_bd_addr_t remote_bda; /*!< HID Remote bluetooth connection index */
+    uint16_t interval;        /*!< Connection interval, in 1.25 ms units */
+    uint16_t latency;         /*!< Peripheral latency, in connection events */
   } connect;                  /*!< HID callback param of ESP_HIDD_EVENT_CONNECT */
 
   /**
@@ -157,8 +163,12 @@ void esp_hidd_send_consumer_value(uint16_t conn_id, uint8_t key_cmd, bool key_pr
 
 void esp_hidd_send_keyboard_value(uint16_t conn_id, key_mask_t special_key_mask, uint8_t *keyboard_cmd, uint8_t num_key);
 
+void esp_hidd_set_battery_level(uint8_t level);
+
 void esp_hidd_send_battery_level(uint16_t conn_id, uint8_t level);
 
+void esp_hidd_send_vendor_value(uint16_t conn_id, const uint8_t *data, uint8_t length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -9,13 +9,20 @@
 #include "esp_gatts_api.h"
 #include "esp_hidd_prf_api.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "link_sync.h"
+#include "nvs.h"
 #include "nvs_flash.h"
+#include "sdkconfig.h"
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,8 +31,90 @@ static const char *TAG = "HID";
 
 #define HIDD_DEVICE_NAME "Liberty Pad"
 
+// Connection parameters requested while the pad is idle: 30-60 ms interval, 10 skippable events
+#define HID_IDLE_CONN_MIN_INTERVAL 0x18
+#define HID_IDLE_CONN_MAX_INTERVAL 0x30
+#define HID_IDLE_CONN_LATENCY 10
+#define HID_CONN_SUPERVISION_TIMEOUT 400
+
+// Reconnect advertising phases, in 0.625 ms interval units and milliseconds
+#define HID_FAST_ADV_INTERVAL_MIN 0x20
+#define HID_FAST_ADV_INTERVAL_MAX 0x30
+#define HID_SLOW_ADV_INTERVAL_MIN 0x640
+#define HID_SLOW_ADV_INTERVAL_MAX 0x780
+// High duty cycle directed advertising is limited to 1.28 s by the specification
+#define HID_DIRECTED_ADV_DURATION_MS 1280
+#define HID_FAST_ADV_DURATION_MS (30 * 1000)
+
+// LE defaults of a new link, before any PHY or data length update
+#define HID_LINK_DEFAULT_PHY 1
+#define HID_LINK_DEFAULT_OCTETS 27
+
+#define HID_NVS_NAMESPACE "hid"
+#define HID_NVS_HOSTS_KEY "hosts"
+// Single host record written by earlier firmware, migrated into the first slot
+#define HID_NVS_LAST_HOST_KEY "last_host"
+
+enum adv_phase {
+  // High duty directed advertising to the host of the active slot
+  ADV_PHASE_DIRECTED,
+  // Fast undirected advertising, only the host of the active slot may connect
+  ADV_PHASE_ACCEPT_LIST,
+  // Fast undirected advertising open to any host, when the active slot is empty
+  ADV_PHASE_FAST,
+  // Slow undirected advertising until a connection, filtered like the phase before it
+  ADV_PHASE_SLOW,
+};
+
+static const char *adv_phase_names[] = {
+  [ADV_PHASE_DIRECTED] = "directed",
+  [ADV_PHASE_ACCEPT_LIST] = "accept list",
+  [ADV_PHASE_FAST] = "fast",
+  [ADV_PHASE_SLOW] = "slow",
+};
+
+static const char *phy_names[] = { "none", "1M", "2M", "Coded" };
+
+struct hid_host {
+  esp_bd_addr_t bda;
+  esp_ble_addr_type_t addr_type;
+  uint8_t is_used;
+};
+
+// Host slots and the active one, read and written as a single NVS blob
+struct hid_hosts {
+  uint8_t active;
+  struct hid_host hosts[HID_HOSTS_COUNT];
+};
+
+static enum adv_phase adv_phase = ADV_PHASE_SLOW;
+static bool is_advertising = false;
+// Host slot requested from another task, only the Bluetooth callbacks make it active; -1 when none
+static _Atomic int8_t requested_host = -1;
+// Copy of hosts.active for other tasks, written by the Bluetooth callbacks only
+static _Atomic uint8_t active_host = 0;
+static esp_timer_handle_t adv_phase_timer = NULL;
+static struct hid_hosts hosts = { 0 };
+static bool is_active_host_bonded = false;
+// Active slot as last written to NVS
+static uint8_t stored_active_host = 0;
+
+// Time-to-first-report bookkeeping, from boot and then from each disconnection
+static int64_t reconnect_started_at = 0;
+static bool is_first_report_pending = true;
+// Host switch bookkeeping, from the switch request reaching the Bluetooth callbacks to the first report
+static int64_t switch_started_at = 0;
+static bool is_switch_pending = false;
+
+static bool is_connected = false;
+static struct hid_link_info link_info = { 0 };
 static uint16_t hid_conn_id = 0;
+static esp_bd_addr_t hid_remote_bda = { 0 };
 static bool sec_conn = false;
+static hid_vendor_handler_t vendor_handler = NULL;
+
+_Static_assert(HID_VENDOR_REPORT_LENGTH == HID_VENDOR_IN_RPT_LEN, "vendor input report length mismatch");
+_Static_assert(HID_VENDOR_REQUEST_LENGTH == HID_VENDOR_OUT_RPT_LEN, "vendor output report length mismatch");
 
 static uint8_t hidd_service_uuid128[] = {
   /* LSB <--------------------------------------------------------------------------------> MSB */
@@ -65,14 +154,206 @@ static esp_ble_adv_data_t hidd_adv_data = {
 };
 
 static esp_ble_adv_params_t hidd_adv_params = {
-  .adv_int_min = 0x20,
-  .adv_int_max = 0x30,
+  .adv_int_min = HID_FAST_ADV_INTERVAL_MIN,
+  .adv_int_max = HID_FAST_ADV_INTERVAL_MAX,
   .adv_type = ADV_TYPE_IND,
   .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
   .channel_map = ADV_CHNL_ALL,
   .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
 };
 
+static void save_hosts() {
+  nvs_handle_t handle;
+
+  if (nvs_open(HID_NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+    if (nvs_set_blob(handle, HID_NVS_HOSTS_KEY, &hosts, sizeof(hosts)) == ESP_OK) {
+      nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+  stored_active_host = hosts.active;
+}
+
+static void load_hosts() {
+  nvs_handle_t handle;
+  size_t length = sizeof(hosts);
+  bool is_loaded = false;
+
+  if (nvs_open(HID_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+    is_loaded = nvs_get_blob(handle, HID_NVS_HOSTS_KEY, &hosts, &length) == ESP_OK && length == sizeof(hosts) &&
+                hosts.active < HID_HOSTS_COUNT;
+    if (!is_loaded) {
+      memset(&hosts, 0, sizeof(hosts));
+      // The last host record has the slot layout without the is_used flag
+      length = offsetof(struct hid_host, is_used);
+      hosts.hosts[0].is_used = nvs_get_blob(handle, HID_NVS_LAST_HOST_KEY, &hosts.hosts[0], &length) == ESP_OK &&
+                               length == offsetof(struct hid_host, is_used);
+    }
+    nvs_close(handle);
+  }
+
+  if (!is_loaded && hosts.hosts[0].is_used) {
+    ESP_LOGI(TAG, "last host migrated to slot 0");
+    save_hosts();
+  }
+  stored_active_host = hosts.active;
+  atomic_store(&active_host, hosts.active);
+}
+
+static int find_host_slot(const esp_bd_addr_t bda) {
+  for (int i = 0; i < HID_HOSTS_COUNT; i++) {
+    if (hosts.hosts[i].is_used && memcmp(hosts.hosts[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Give the active slot to a host that just authenticated, false when it belongs to another slot
+static bool claim_active_host(const esp_bd_addr_t bda, esp_ble_addr_type_t addr_type) {
+  struct hid_host *host = &hosts.hosts[hosts.active];
+  int slot = find_host_slot(bda);
+
+  if (slot >= 0 && slot != hosts.active) {
+    return false;
+  }
+
+  if (slot < 0 || host->addr_type != addr_type) {
+    memcpy(host->bda, bda, sizeof(esp_bd_addr_t));
+    host->addr_type = addr_type;
+    host->is_used = true;
+  } else if (hosts.active == stored_active_host) {
+    // Plain reconnections leave the flash alone
+    return true;
+  }
+
+  save_hosts();
+  return true;
+}
+
+// Only the host of the active slot goes on the accept list, bonds of the other slots are left untouched
+static void load_bonded_hosts() {
+  struct hid_host *host = &hosts.hosts[hosts.active];
+  int bonded_hosts_count = esp_ble_get_bond_device_num();
+
+  is_active_host_bonded = false;
+  esp_ble_gap_clear_whitelist();
+  if (host->is_used && bonded_hosts_count > 0) {
+    esp_ble_bond_dev_t *bonded_hosts = malloc(sizeof(esp_ble_bond_dev_t) * bonded_hosts_count);
+    if (bonded_hosts == NULL) {
+      return;
+    }
+
+    esp_ble_get_bond_device_list(&bonded_hosts_count, bonded_hosts);
+    for (int i = 0; i < bonded_hosts_count; i++) {
+      if (memcmp(bonded_hosts[i].bd_addr, host->bda, sizeof(esp_bd_addr_t)) == 0) {
+        is_active_host_bonded = true;
+        esp_ble_gap_update_whitelist(true, bonded_hosts[i].bd_addr,
+                                     bonded_hosts[i].bd_addr_type == BLE_ADDR_TYPE_PUBLIC ? BLE_WL_ADDR_TYPE_PUBLIC : BLE_WL_ADDR_TYPE_RANDOM);
+      }
+    }
+    free(bonded_hosts);
+  }
+
+  ESP_LOGI(TAG, "%d bonded hosts, slot %d %s", bonded_hosts_count, hosts.active,
+           is_active_host_bonded ? "bonded" : "open for pairing");
+}
+
+static void start_advertising(enum adv_phase phase) {
+  esp_ble_adv_params_t adv_params = hidd_adv_params;
+  uint32_t duration_ms = 0;
+
+  switch (phase) {
+  case ADV_PHASE_DIRECTED:
+    adv_params.adv_type = ADV_TYPE_DIRECT_IND_HIGH;
+    memcpy(adv_params.peer_addr, hosts.hosts[hosts.active].bda, sizeof(esp_bd_addr_t));
+    adv_params.peer_addr_type = hosts.hosts[hosts.active].addr_type;
+    // Identity address of the bond, as on the accept list: no resolving list is set up, so only hosts
+    // connecting from a public or static random address are matched
+    duration_ms = HID_DIRECTED_ADV_DURATION_MS;
+    break;
+  case ADV_PHASE_ACCEPT_LIST:
+    adv_params.adv_filter_policy = ADV_FILTER_ALLOW_SCAN_WLST_CON_WLST;
+    duration_ms = HID_FAST_ADV_DURATION_MS;
+    break;
+  case ADV_PHASE_FAST:
+    duration_ms = HID_FAST_ADV_DURATION_MS;
+    break;
+  case ADV_PHASE_SLOW:
+    adv_params.adv_int_min = HID_SLOW_ADV_INTERVAL_MIN;
+    adv_params.adv_int_max = HID_SLOW_ADV_INTERVAL_MAX;
+    if (is_active_host_bonded) {
+      adv_params.adv_filter_policy = ADV_FILTER_ALLOW_SCAN_WLST_CON_WLST;
+    }
+    break;
+  }
+
+  adv_phase = phase;
+  is_advertising = true;
+  ESP_LOGI(TAG, "%s advertising", adv_phase_names[phase]);
+  esp_ble_gap_start_advertising(&adv_params);
+  if (duration_ms > 0) {
+    esp_timer_start_once(adv_phase_timer, (uint64_t)duration_ms * 1000);
+  }
+}
+
+static enum adv_phase next_adv_phase(enum adv_phase phase) {
+  switch (phase) {
+  case ADV_PHASE_DIRECTED:
+    return ADV_PHASE_ACCEPT_LIST;
+  default:
+    return ADV_PHASE_SLOW;
+  }
+}
+
+// The phase ends on ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT, which starts the next one. Runs in the timer
+// task, the event handler checks whether advertising is still running
+static void on_adv_phase_timeout(void *arg) {
+  esp_ble_gap_stop_advertising();
+}
+
+// Bluetooth callbacks only, hands a requested slot over to the advertising and bonding state
+static void take_requested_host() {
+  int8_t slot = atomic_exchange(&requested_host, -1);
+  if (slot < 0 || slot == hosts.active) {
+    return;
+  }
+
+  ESP_LOGI(TAG, "switching from host %d to host %d", hosts.active, slot);
+  hosts.active = slot;
+  atomic_store(&active_host, slot);
+  is_switch_pending = true;
+}
+
+static void start_reconnect() {
+  take_requested_host();
+  load_bonded_hosts();
+
+  if (is_active_host_bonded) {
+    start_advertising(ADV_PHASE_DIRECTED);
+  } else {
+    start_advertising(ADV_PHASE_FAST);
+  }
+}
+
+static void reset_link_info() {
+  link_info.tx_phy = HID_LINK_DEFAULT_PHY;
+  link_info.rx_phy = HID_LINK_DEFAULT_PHY;
+  link_info.tx_octets = HID_LINK_DEFAULT_OCTETS;
+  link_info.rx_octets = HID_LINK_DEFAULT_OCTETS;
+}
+
+// Each procedure falls back on its own, a host refusing one keeps the LE default for it
+static void upgrade_link() {
+#if HID_LINK_UPGRADE
+  esp_ble_gap_set_pkt_data_len(hid_remote_bda, HID_LINK_DATA_LENGTH);
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+  esp_ble_gap_set_preferred_phy(hid_remote_bda, 0, ESP_BLE_GAP_PHY_2M_PREF_MASK, ESP_BLE_GAP_PHY_2M_PREF_MASK,
+                                ESP_BLE_GAP_PHY_OPTIONS_NO_PREF);
+#endif
+#endif
+}
+
 static void hidd_event_callback(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *param) {
   switch (event) {
   case ESP_HIDD_EVENT_REG_FINISH: {
@@ -89,13 +370,37 @@ static void hidd_event_callback(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *
     break;
   case ESP_HIDD_EVENT_BLE_CONNECT: {
     ESP_LOGI(TAG, "ESP_HIDD_EVENT_BLE_CONNECT");
+    is_connected = true;
+    reset_link_info();
     hid_conn_id = param->connect.conn_id;
+    memcpy(hid_remote_bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+    // A switch requested while this host was connecting, the disconnection carries it out
+    int8_t requested = atomic_load(&requested_host);
+    if (requested >= 0 && requested != hosts.active) {
+      esp_ble_gap_disconnect(hid_remote_bda);
+    }
+    is_advertising = false;
+    esp_timer_stop(adv_phase_timer);
+    link_sync_set_interval(param->connect.interval * 1250, param->connect.latency);
+    ESP_LOGI(TAG, "connected %" PRId64 " ms after %s, during %s advertising", (esp_timer_get_time() - reconnect_started_at) / 1000,
+             reconnect_started_at == 0 ? "boot" : "disconnection", adv_phase_names[adv_phase]);
     break;
   }
   case ESP_HIDD_EVENT_BLE_DISCONNECT: {
+    is_connected = false;
     sec_conn = false;
     ESP_LOGI(TAG, "ESP_HIDD_EVENT_BLE_DISCONNECT");
-    esp_ble_gap_start_advertising(&hidd_adv_params);
+    link_sync_set_interval(0, 0);
+    reconnect_started_at = esp_timer_get_time();
+    is_first_report_pending = true;
+    start_reconnect();
+    break;
+  }
+  case ESP_HIDD_EVENT_BLE_VENDOR_REPORT_WRITE_EVT: {
+    ESP_LOGD(TAG, "ESP_HIDD_EVENT_BLE_VENDOR_REPORT_WRITE_EVT");
+    if (vendor_handler != NULL) {
+      vendor_handler(param->vendor_write.data, param->vendor_write.length);
+    }
     break;
   }
   case ESP_HIDD_EVENT_BLE_LED_REPORT_WRITE_EVT: {
@@ -111,9 +416,73 @@ static void hidd_event_callback(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *
 
 static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
   switch (event) {
-  case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
-    esp_ble_gap_start_advertising(&hidd_adv_params);
+  case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT: {
+    // Raised at boot, then by hid_select_host to hand a switch request over to the Bluetooth callbacks
+    if (!is_connected && !is_advertising) {
+      start_reconnect();
+      break;
+    }
+
+    int8_t requested = atomic_load(&requested_host);
+    if (requested < 0 || requested == hosts.active) {
+      atomic_compare_exchange_strong(&requested_host, &requested, -1);
+      break;
+    }
+
+    // Tearing down the link or the advertising raises the event that takes the request
+    switch_started_at = esp_timer_get_time();
+    if (is_connected) {
+      esp_ble_gap_disconnect(hid_remote_bda);
+    } else {
+      esp_timer_stop(adv_phase_timer);
+      esp_ble_gap_stop_advertising();
+    }
+    break;
+  }
+  case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
+    // Stopped by the phase timer or a host switch, a connection ends advertising without this event
+    if (!is_connected && atomic_load(&requested_host) >= 0) {
+      esp_timer_stop(adv_phase_timer);
+      start_reconnect();
+    } else if (is_advertising) {
+      start_advertising(next_adv_phase(adv_phase));
+    }
+    break;
+  case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+    if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+      link_sync_set_interval(param->update_conn_params.conn_int * 1250, param->update_conn_params.latency);
+    }
+    break;
+  case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:
+    if (param->pkt_data_length_cmpl.status == ESP_BT_STATUS_SUCCESS) {
+      link_info.tx_octets = param->pkt_data_length_cmpl.params.tx_len;
+      link_info.rx_octets = param->pkt_data_length_cmpl.params.rx_len;
+    }
+    ESP_LOGI(TAG, "data length %s, tx %d bytes, rx %d bytes",
+             param->pkt_data_length_cmpl.status == ESP_BT_STATUS_SUCCESS ? "updated" : "refused",
+             link_info.tx_octets, link_info.rx_octets);
+    break;
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+  case ESP_GAP_BLE_SET_PREFERRED_PHY_COMPLETE_EVT:
+    // A host already on the preferred PHY, or not supporting it, raises no update event
+    esp_ble_gap_read_phy(hid_remote_bda);
+    break;
+  case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT:
+    if (param->phy_update.status == ESP_BT_STATUS_SUCCESS) {
+      link_info.tx_phy = param->phy_update.tx_phy;
+      link_info.rx_phy = param->phy_update.rx_phy;
+    }
+    ESP_LOGI(TAG, "PHY update %s, tx %s, rx %s", param->phy_update.status == ESP_BT_STATUS_SUCCESS ? "done" : "refused",
+             phy_names[link_info.tx_phy], phy_names[link_info.rx_phy]);
     break;
+  case ESP_GAP_BLE_READ_PHY_COMPLETE_EVT:
+    if (param->read_phy.status == ESP_BT_STATUS_SUCCESS) {
+      link_info.tx_phy = param->read_phy.tx_phy;
+      link_info.rx_phy = param->read_phy.rx_phy;
+    }
+    ESP_LOGI(TAG, "PHY tx %s, rx %s", phy_names[link_info.tx_phy], phy_names[link_info.rx_phy]);
+    break;
+#endif
   case ESP_GAP_BLE_SEC_REQ_EVT:
     for (int i = 0; i < ESP_BD_ADDR_LEN; i++) {
       ESP_LOGD(TAG, "%x:", param->ble_security.ble_req.bd_addr[i]);
@@ -129,8 +498,20 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
     ESP_LOGI(TAG, "address type = %d", param->ble_security.auth_cmpl.addr_type);
     ESP_LOGI(TAG, "pair status = %s", param->ble_security.auth_cmpl.success ? "success" : "fail");
     if (param->ble_security.auth_cmpl.success) {
+      // Bonded hosts of other slots may still connect while the active slot is open for pairing
+      if (!claim_active_host(param->ble_security.auth_cmpl.bd_addr, param->ble_security.auth_cmpl.addr_type)) {
+        ESP_LOGI(TAG, "host of slot %d refused, slot %d is active", find_host_slot(param->ble_security.auth_cmpl.bd_addr), hosts.active);
+        esp_ble_gap_disconnect(param->ble_security.auth_cmpl.bd_addr);
+        break;
+      }
       sec_conn = true;
-      ESP_LOGI(TAG, "secure connection established.");
+      ESP_LOGI(TAG, "secure connection established %" PRId64 " ms after %s.", (esp_timer_get_time() - reconnect_started_at) / 1000,
+               reconnect_started_at == 0 ? "boot" : "disconnection");
+      upgrade_link();
+      if (is_switch_pending) {
+        ESP_LOGI(TAG, "secure connection to host %d %" PRId64 " ms after the switch", hosts.active,
+                 (esp_timer_get_time() - switch_started_at) / 1000);
+      }
     } else {
       ESP_LOGE(TAG, "pairing failed, reason = 0x%x",
                param->ble_security.auth_cmpl.fail_reason);
@@ -152,6 +533,13 @@ esp_err_t hid_init(void) {
   }
   ESP_ERROR_CHECK(ret);
 
+  load_hosts();
+  esp_timer_create_args_t adv_phase_timer_args = {
+    .callback = on_adv_phase_timeout,
+    .name = "adv_phase",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&adv_phase_timer_args, &adv_phase_timer));
+
   ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 
   esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
@@ -222,6 +610,16 @@ esp_err_t hid_send_keys(uint8_t modifier, uint8_t keycodes[6], uint8_t keycodes_
   }
 
   esp_hidd_send_keyboard_value(hid_conn_id, modifier, keycodes, keycodes_length);
+  if (is_first_report_pending) {
+    is_first_report_pending = false;
+    ESP_LOGI(TAG, "first report %" PRId64 " ms after %s", (esp_timer_get_time() - reconnect_started_at) / 1000,
+             reconnect_started_at == 0 ? "boot" : "disconnection");
+  }
+  if (is_switch_pending) {
+    is_switch_pending = false;
+    ESP_LOGI(TAG, "switched to host %d in %" PRId64 " ms, from request to first report", hosts.active,
+             (esp_timer_get_time() - switch_started_at) / 1000);
+  }
   return ESP_OK;
 }
 
@@ -235,3 +633,65 @@ esp_err_t hid_send_consumer(uint16_t usage_code) {
   esp_hidd_send_consumer_value(hid_conn_id, usage_code, false);
   return ESP_OK;
 }
+
+void hid_set_low_power(bool is_low_power) {
+  if (!sec_conn) {
+    return;
+  }
+
+  // Intervals in 1.25 ms units, timeout in 10 ms units
+  esp_ble_conn_update_params_t conn_params = {
+    .min_int = is_low_power ? HID_IDLE_CONN_MIN_INTERVAL : hidd_adv_data.min_interval,
+    .max_int = is_low_power ? HID_IDLE_CONN_MAX_INTERVAL : hidd_adv_data.max_interval,
+    .latency = is_low_power ? HID_IDLE_CONN_LATENCY : 0,
+    .timeout = HID_CONN_SUPERVISION_TIMEOUT,
+  };
+  memcpy(conn_params.bda, hid_remote_bda, sizeof(esp_bd_addr_t));
+  esp_ble_gap_update_conn_params(&conn_params);
+}
+
+void hid_set_vendor_handler(hid_vendor_handler_t handler) {
+  vendor_handler = handler;
+}
+
+esp_err_t hid_send_vendor(const uint8_t *data, uint8_t length) {
+  if (!sec_conn) {
+    return ESP_FAIL;
+  }
+
+  if (length > HID_VENDOR_REPORT_LENGTH) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  esp_hidd_send_vendor_value(hid_conn_id, data, length);
+  return ESP_OK;
+}
+
+void hid_set_battery_level(uint8_t level, bool should_notify) {
+  if (should_notify && sec_conn) {
+    esp_hidd_send_battery_level(hid_conn_id, level);
+  } else {
+    esp_hidd_set_battery_level(level);
+  }
+}
+
+esp_err_t hid_select_host(uint8_t slot) {
+  if (slot >= HID_HOSTS_COUNT) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // Called from other tasks, which never read the connection or advertising state: only the request is
+  // recorded here. Setting the advertising data again always completes with an event in the Bluetooth
+  // callbacks, which compare the request with the active slot and tear down the link or the advertising.
+  atomic_store(&requested_host, slot);
+  return esp_ble_gap_config_adv_data(&hidd_adv_data);
+}
+
+void hid_select_next_host(void) {
+  int8_t requested = atomic_load(&requested_host);
+  hid_select_host(((requested >= 0 ? requested : atomic_load(&active_host)) + 1) % HID_HOSTS_COUNT);
+}
+
+void hid_get_link_info(struct hid_link_info *info) {
+  *info = link_info;
+}
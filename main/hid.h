@@ -69,6 +69,32 @@
 #define HID_KEY_RIGHT_ALT (1 << 6)
 #define HID_KEY_RIGHT_GUI (1 << 7)
 
+// Bonded host slots, the chord in key_config.h cycles through them
+#define HID_HOSTS_COUNT 3
+
+// Set to 0 to leave new links on the 1M PHY with 27 byte PDUs
+#define HID_LINK_UPGRADE 1
+// LE data length requested once the link is encrypted, up to 251 bytes
+#define HID_LINK_DATA_LENGTH 251
+
+// Payload sizes of the vendor output (host to device) and input (device to host) reports
+#define HID_VENDOR_REQUEST_LENGTH 127
+#define HID_VENDOR_REPORT_LENGTH 32
+
+// PHY and data length currently used by the link, the LE defaults until the host agrees to more
+struct hid_link_info {
+  // 1 for 1M, 2 for 2M, 3 for Coded
+  uint8_t tx_phy;
+  uint8_t rx_phy;
+  uint16_t tx_octets;
+  uint16_t rx_octets;
+};
+
+/**
+ * @brief Called from the Bluetooth task for each vendor output report written by the host
+ */
+typedef void (*hid_vendor_handler_t)(const uint8_t *data, uint16_t length);
+
 /**
  * @brief Initialize BLE HID device
  */
@@ -96,4 +122,47 @@ esp_err_t hid_send_keys(uint8_t modifier, uint8_t keycodes[6], uint8_t keycodes_
  * @brief Send consumer control command (media keys)
  * @param usage_code Consumer usage code (HID_CONSUMER_*)
  */
-esp_err_t hid_send_consumer(uint16_t usage_code);
\ No newline at end of file
+esp_err_t hid_send_consumer(uint16_t usage_code);
+
+/**
+ * @brief Ask the host for a long connection interval with peripheral latency, or back to the fast one
+ */
+void hid_set_low_power(bool is_low_power);
+
+/**
+ * @brief Register the handler of vendor output reports
+ */
+void hid_set_vendor_handler(hid_vendor_handler_t handler);
+
+/**
+ * @brief Send a vendor input report, zero padded to HID_VENDOR_REPORT_LENGTH
+ * @param length Number of bytes in data (max HID_VENDOR_REPORT_LENGTH)
+ */
+esp_err_t hid_send_vendor(const uint8_t *data, uint8_t length);
+
+/**
+ * @brief Update the battery level characteristic
+ * @param should_notify Also notify the connected host, the value is only stored while disconnected
+ * @note The battery CCCD is not checked, the stack keeps a single copy of it for every bond and forgets it
+ *       on reboot; notifications are rate limited by the battery task instead
+ */
+void hid_set_battery_level(uint8_t level, bool should_notify);
+
+/**
+ * @brief Switch the active host slot, an empty slot advertises for pairing
+ *        The current host is disconnected but keeps its bond and slot
+ * @note Callable from any task, the request is handed over to the Bluetooth callbacks, which alone read the
+ *       connection and advertising state. Directed reconnection needs a host using its identity address
+ * @param slot Host slot (max HID_HOSTS_COUNT - 1)
+ */
+esp_err_t hid_select_host(uint8_t slot);
+
+/**
+ * @brief Switch to the next host slot, wrapping around
+ */
+void hid_select_next_host(void);
+
+/**
+ * @brief Get the PHY and data length negotiated with the connected host
+ */
+void hid_get_link_info(struct hid_link_info *info);
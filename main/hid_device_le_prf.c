@@ -22,12 +22,10 @@ struct prf_char_pres_fmt {
   uint8_t name_space;
 };
 
-// HID report mapping table
-static hid_report_map_t hid_rpt_map[HID_NUM_REPORTS];
-
 // HID Report Map characteristic value
-// Original working descriptor with mouse + keyboard + consumer control
+// Keyboard + consumer control, plus the mouse and vendor collections when enabled
 static const uint8_t hidReportMap[] = {
+#if (SUPPORT_REPORT_MOUSE == true)
     0x05, 0x01,  // Usage Page (Generic Desktop)
     0x09, 0x02,  // Usage (Mouse)
     0xA1, 0x01,  // Collection (Application)
@@ -56,6 +54,7 @@ static const uint8_t hidReportMap[] = {
     0x81, 0x06,  //     Input (Data, Variable, Relative) - X & Y coordinate
     0xC0,        //   End Collection
     0xC0,        // End Collection
+#endif
 
     0x05, 0x01,  // Usage Pg (Generic Desktop)
     0x09, 0x06,  // Usage (Keyboard)
@@ -77,6 +76,7 @@ static const uint8_t hidReportMap[] = {
     0x95, 0x01,  //   Report Count (1)
     0x75, 0x08,  //   Report Size (8)
     0x81, 0x01,  //   Input: (Constant)
+#if (SUPPORT_REPORT_LED == true)
     //
     //   LED report
     0x05, 0x08,  //   Usage Pg (LEDs)
@@ -90,6 +90,7 @@ static const uint8_t hidReportMap[] = {
     0x95, 0x01,  //   Report Count (1)
     0x75, 0x03,  //   Report Size (3)
     0x91, 0x01,  //   Output: (Constant)
+#endif
     //
     //   Key arrays (6 bytes)
     0x95, 0x06,  //   Report Count (6)
@@ -171,6 +172,11 @@ static const uint8_t hidReportMap[] = {
   0x75, 0x08,       // Report Size
   0x95, 0x7F,       // Report Count = 127 Btyes
   0x91, 0x02,       // Output(Data, Variable, Absolute)
+  0x85, 0x05,       // Report Id (5)
+  0x09, 0xA7,       // Usage(Vendor defined)
+  0x75, 0x08,       // Report Size
+  0x95, HID_VENDOR_IN_RPT_LEN, // Report Count
+  0x81, 0x02,       // Input(Data, Variable, Absolute)
   0xC0,             // End Collection
 #endif
 
@@ -203,12 +209,9 @@ struct gatts_profile_inst {
 hidd_le_env_t hidd_le_env;
 
 // HID report map length
-uint8_t hidReportMapLen = sizeof(hidReportMap);
+uint16_t hidReportMapLen = sizeof(hidReportMap);
 uint8_t hidProtocolMode = HID_PROTOCOL_MODE_REPORT;
 
-// HID report mapping table
-// static hidRptMap_t  hidRptMap[HID_NUM_REPORTS];
-
 // HID Information characteristic value
 static const uint8_t hidInfo[HID_INFORMATION_LEN] = {
   LO_UINT16(0x0111), HI_UINT16(0x0111), // bcdHID (USB HID version)
@@ -217,27 +220,78 @@ static const uint8_t hidInfo[HID_INFORMATION_LEN] = {
 };
 
 // HID External Report Reference Descriptor
-static uint16_t hidExtReportRefDesc = ESP_GATT_UUID_BATTERY_LEVEL;
+static const uint16_t hidExtReportRefDesc = ESP_GATT_UUID_BATTERY_LEVEL;
 
+#if (SUPPORT_REPORT_MOUSE == true)
 // HID Report Reference characteristic descriptor, mouse input
-static uint8_t hidReportRefMouseIn[HID_REPORT_REF_LEN] = { HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT };
+static const uint8_t hidReportRefMouseIn[HID_REPORT_REF_LEN] = { HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT };
+#endif
 
 // HID Report Reference characteristic descriptor, key input
-static uint8_t hidReportRefKeyIn[HID_REPORT_REF_LEN] = { HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT };
+static const uint8_t hidReportRefKeyIn[HID_REPORT_REF_LEN] = { HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT };
 
+#if (SUPPORT_REPORT_LED == true)
 // HID Report Reference characteristic descriptor, LED output
-static uint8_t hidReportRefLedOut[HID_REPORT_REF_LEN] = { HID_RPT_ID_LED_OUT, HID_REPORT_TYPE_OUTPUT };
+static const uint8_t hidReportRefLedOut[HID_REPORT_REF_LEN] = { HID_RPT_ID_LED_OUT, HID_REPORT_TYPE_OUTPUT };
+#endif
 
 #if (SUPPORT_REPORT_VENDOR == true)
 
-static uint8_t hidReportRefVendorOut[HID_REPORT_REF_LEN] = { HID_RPT_ID_VENDOR_OUT, HID_REPORT_TYPE_OUTPUT };
+static const uint8_t hidReportRefVendorOut[HID_REPORT_REF_LEN] = { HID_RPT_ID_VENDOR_OUT, HID_REPORT_TYPE_OUTPUT };
+
+// HID Report Reference characteristic descriptor, vendor input
+static const uint8_t hidReportRefVendorIn[HID_REPORT_REF_LEN] = { HID_RPT_ID_VENDOR_IN, HID_REPORT_TYPE_INPUT };
 #endif
 
+#if (SUPPORT_REPORT_FEATURE == true)
 // HID Report Reference characteristic descriptor, Feature
-static uint8_t hidReportRefFeature[HID_REPORT_REF_LEN] = { HID_RPT_ID_FEATURE, HID_REPORT_TYPE_FEATURE };
+static const uint8_t hidReportRefFeature[HID_REPORT_REF_LEN] = { HID_RPT_ID_FEATURE, HID_REPORT_TYPE_FEATURE };
+#endif
 
 // HID Report Reference characteristic descriptor, consumer control input
-static uint8_t hidReportRefCCIn[HID_REPORT_REF_LEN] = { HID_RPT_ID_CC_IN, HID_REPORT_TYPE_INPUT };
+static const uint8_t hidReportRefCCIn[HID_REPORT_REF_LEN] = { HID_RPT_ID_CC_IN, HID_REPORT_TYPE_INPUT };
+
+// Report characteristic of the service and the report it carries, HIDD_LE_IDX_SVC stands for no CCCD
+typedef struct {
+  uint8_t id;
+  uint8_t type;
+  uint8_t mode;
+  uint8_t val_idx;
+  uint8_t ccc_idx;
+} hid_report_def_t;
+
+// Reports registered with hid_dev_register_reports, following the attribute table below
+static const hid_report_def_t hid_rpt_defs[] = {
+#if (SUPPORT_REPORT_MOUSE == true)
+  { HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_PROTOCOL_MODE_REPORT, HIDD_LE_IDX_REPORT_MOUSE_IN_VAL, HIDD_LE_IDX_REPORT_MOUSE_IN_CCC },
+#endif
+  { HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT, HID_PROTOCOL_MODE_REPORT, HIDD_LE_IDX_REPORT_KEY_IN_VAL, HIDD_LE_IDX_REPORT_KEY_IN_CCC },
+#if (SUPPORT_REPORT_LED == true)
+  { HID_RPT_ID_LED_OUT, HID_REPORT_TYPE_OUTPUT, HID_PROTOCOL_MODE_REPORT, HIDD_LE_IDX_REPORT_LED_OUT_VAL, HIDD_LE_IDX_SVC },
+#endif
+#if (SUPPORT_REPORT_VENDOR == true)
+  // Vendor input report, carries protocol responses and streamed key travel
+  { HID_RPT_ID_VENDOR_IN, HID_REPORT_TYPE_INPUT, HID_PROTOCOL_MODE_REPORT, HIDD_LE_IDX_REPORT_VENDOR_IN_VAL, HIDD_LE_IDX_REPORT_VENDOR_IN_CCC },
+#endif
+  { HID_RPT_ID_CC_IN, HID_REPORT_TYPE_INPUT, HID_PROTOCOL_MODE_REPORT, HIDD_LE_IDX_REPORT_CC_IN_VAL, HIDD_LE_IDX_REPORT_CC_IN_CCC },
+#if (SUPPORT_BOOT_KEYBOARD == true)
+  // Boot reports use the same ID and type as their report protocol counterparts
+  { HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT, HID_PROTOCOL_MODE_BOOT, HIDD_LE_IDX_BOOT_KB_IN_REPORT_VAL, HIDD_LE_IDX_BOOT_KB_IN_REPORT_NTF_CFG },
+  { HID_RPT_ID_LED_OUT, HID_REPORT_TYPE_OUTPUT, HID_PROTOCOL_MODE_BOOT, HIDD_LE_IDX_BOOT_KB_OUT_REPORT_VAL, HIDD_LE_IDX_SVC },
+#endif
+#if (SUPPORT_BOOT_MOUSE == true)
+  { HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT, HID_PROTOCOL_MODE_BOOT, HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_VAL, HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_NTF_CFG },
+#endif
+#if (SUPPORT_REPORT_FEATURE == true)
+  { HID_RPT_ID_FEATURE, HID_REPORT_TYPE_FEATURE, HID_PROTOCOL_MODE_REPORT, HIDD_LE_IDX_REPORT_VAL, HIDD_LE_IDX_SVC },
+#endif
+};
+
+// Number of HID reports defined in the service
+#define HID_NUM_REPORTS (sizeof(hid_rpt_defs) / sizeof(hid_rpt_defs[0]))
+
+// HID report mapping table
+static hid_report_map_t hid_rpt_map[HID_NUM_REPORTS];
 
 /*
  *  Heart Rate PROFILE ATTRIBUTES
@@ -245,7 +299,7 @@ static uint8_t hidReportRefCCIn[HID_REPORT_REF_LEN] = { HID_RPT_ID_CC_IN, HID_RE
  */
 
 /// hid Service uuid
-static uint16_t hid_le_svc = ATT_SVC_HID;
+static const uint16_t hid_le_svc = ATT_SVC_HID;
 uint16_t hid_count = 0;
 esp_gatts_incl_svc_desc_t incl_svc = { 0 };
 
@@ -303,7 +357,7 @@ static const esp_gatts_attr_db_t bas_att_db[BAS_IDX_NB] = {
 };
 
 /// Full Hid device Database Description - Used to add attributes into the database
-static esp_gatts_attr_db_t hidd_le_gatt_db[HIDD_LE_IDX_NB] = {
+static const esp_gatts_attr_db_t hidd_le_gatt_db[HIDD_LE_IDX_NB] = {
   // HID Service Declaration
   [HIDD_LE_IDX_SVC] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&primary_service_uuid, ESP_GATT_PERM_READ_ENCRYPTED, sizeof(uint16_t), sizeof(hid_le_svc), (uint8_t *)&hid_le_svc } },
 
@@ -333,13 +387,15 @@ static esp_gatts_attr_db_t hidd_le_gatt_db[HIDD_LE_IDX_NB] = {
   // Protocol Mode Characteristic Value
   [HIDD_LE_IDX_PROTO_MODE_VAL] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_proto_mode_uuid, (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE), sizeof(uint8_t), sizeof(hidProtocolMode), (uint8_t *)&hidProtocolMode } },
 
+#if (SUPPORT_REPORT_MOUSE == true)
   [HIDD_LE_IDX_REPORT_MOUSE_IN_CHAR] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ, CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_notify } },
 
   [HIDD_LE_IDX_REPORT_MOUSE_IN_VAL] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_uuid, ESP_GATT_PERM_READ, HIDD_LE_REPORT_MAX_LEN, 0, NULL } },
 
   [HIDD_LE_IDX_REPORT_MOUSE_IN_CCC] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid, (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE), sizeof(uint16_t), 0, NULL } },
 
-  [HIDD_LE_IDX_REPORT_MOUSE_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefMouseIn), sizeof(hidReportRefMouseIn), hidReportRefMouseIn } },
+  [HIDD_LE_IDX_REPORT_MOUSE_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefMouseIn), sizeof(hidReportRefMouseIn), (uint8_t *)hidReportRefMouseIn } },
+#endif
   // Report Characteristic Declaration
   [HIDD_LE_IDX_REPORT_KEY_IN_CHAR] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ, CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_notify } },
   // Report Characteristic Value
@@ -347,18 +403,28 @@ static esp_gatts_attr_db_t hidd_le_gatt_db[HIDD_LE_IDX_NB] = {
   // Report KEY INPUT Characteristic - Client Characteristic Configuration Descriptor
   [HIDD_LE_IDX_REPORT_KEY_IN_CCC] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid, (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE), sizeof(uint16_t), 0, NULL } },
   // Report Characteristic - Report Reference Descriptor
-  [HIDD_LE_IDX_REPORT_KEY_IN_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefKeyIn), sizeof(hidReportRefKeyIn), hidReportRefKeyIn } },
+  [HIDD_LE_IDX_REPORT_KEY_IN_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefKeyIn), sizeof(hidReportRefKeyIn), (uint8_t *)hidReportRefKeyIn } },
 
+#if (SUPPORT_REPORT_LED == true)
   // Report Characteristic Declaration
   [HIDD_LE_IDX_REPORT_LED_OUT_CHAR] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ, CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_write_write_nr } },
 
   [HIDD_LE_IDX_REPORT_LED_OUT_VAL] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, HIDD_LE_REPORT_MAX_LEN, 0, NULL } },
-  [HIDD_LE_IDX_REPORT_LED_OUT_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefLedOut), sizeof(hidReportRefLedOut), hidReportRefLedOut } },
+  [HIDD_LE_IDX_REPORT_LED_OUT_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefLedOut), sizeof(hidReportRefLedOut), (uint8_t *)hidReportRefLedOut } },
+#endif
 #if (SUPPORT_REPORT_VENDOR == true)
   // Report Characteristic Declaration
   [HIDD_LE_IDX_REPORT_VENDOR_OUT_CHAR] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ, CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_write_notify } },
   [HIDD_LE_IDX_REPORT_VENDOR_OUT_VAL] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, HIDD_LE_REPORT_MAX_LEN, 0, NULL } },
-  [HIDD_LE_IDX_REPORT_VENDOR_OUT_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefVendorOut), sizeof(hidReportRefVendorOut), hidReportRefVendorOut } },
+  [HIDD_LE_IDX_REPORT_VENDOR_OUT_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefVendorOut), sizeof(hidReportRefVendorOut), (uint8_t *)hidReportRefVendorOut } },
+  // Report Characteristic Declaration
+  [HIDD_LE_IDX_REPORT_VENDOR_IN_CHAR] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ, CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_notify } },
+  // Report Characteristic Value
+  [HIDD_LE_IDX_REPORT_VENDOR_IN_VAL] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_uuid, ESP_GATT_PERM_READ, HIDD_LE_REPORT_MAX_LEN, 0, NULL } },
+  // Report VENDOR INPUT Characteristic - Client Characteristic Configuration Descriptor
+  [HIDD_LE_IDX_REPORT_VENDOR_IN_CCC] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid, (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE), sizeof(uint16_t), 0, NULL } },
+  // Report Characteristic - Report Reference Descriptor
+  [HIDD_LE_IDX_REPORT_VENDOR_IN_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefVendorIn), sizeof(hidReportRefVendorIn), (uint8_t *)hidReportRefVendorIn } },
 #endif
   // Report Characteristic Declaration
   [HIDD_LE_IDX_REPORT_CC_IN_CHAR] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ, CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_notify } },
@@ -367,8 +433,9 @@ static esp_gatts_attr_db_t hidd_le_gatt_db[HIDD_LE_IDX_NB] = {
   // Report KEY INPUT Characteristic - Client Characteristic Configuration Descriptor
   [HIDD_LE_IDX_REPORT_CC_IN_CCC] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid, (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE_ENCRYPTED), sizeof(uint16_t), 0, NULL } },
   // Report Characteristic - Report Reference Descriptor
-  [HIDD_LE_IDX_REPORT_CC_IN_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefCCIn), sizeof(hidReportRefCCIn), hidReportRefCCIn } },
+  [HIDD_LE_IDX_REPORT_CC_IN_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefCCIn), sizeof(hidReportRefCCIn), (uint8_t *)hidReportRefCCIn } },
 
+#if (SUPPORT_BOOT_KEYBOARD == true)
   // Boot Keyboard Input Report Characteristic Declaration
   [HIDD_LE_IDX_BOOT_KB_IN_REPORT_CHAR] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ, CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_notify } },
   // Boot Keyboard Input Report Characteristic Value
@@ -380,20 +447,25 @@ static esp_gatts_attr_db_t hidd_le_gatt_db[HIDD_LE_IDX_NB] = {
   [HIDD_LE_IDX_BOOT_KB_OUT_REPORT_CHAR] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ, CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_write } },
   // Boot Keyboard Output Report Characteristic Value
   [HIDD_LE_IDX_BOOT_KB_OUT_REPORT_VAL] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_kb_output_uuid, (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE), HIDD_LE_BOOT_REPORT_MAX_LEN, 0, NULL } },
+#endif
 
+#if (SUPPORT_BOOT_MOUSE == true)
   // Boot Mouse Input Report Characteristic Declaration
   [HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_CHAR] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ, CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_notify } },
   // Boot Mouse Input Report Characteristic Value
   [HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_VAL] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_mouse_input_uuid, ESP_GATT_PERM_READ, HIDD_LE_BOOT_REPORT_MAX_LEN, 0, NULL } },
   // Boot Mouse Input Report Characteristic - Client Characteristic Configuration Descriptor
   [HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_NTF_CFG] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid, (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE), sizeof(uint16_t), 0, NULL } },
+#endif
 
+#if (SUPPORT_REPORT_FEATURE == true)
   // Report Characteristic Declaration
   [HIDD_LE_IDX_REPORT_CHAR] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ, CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_read_write } },
   // Report Characteristic Value
   [HIDD_LE_IDX_REPORT_VAL] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_uuid, ESP_GATT_PERM_READ, HIDD_LE_REPORT_MAX_LEN, 0, NULL } },
   // Report Characteristic - Report Reference Descriptor
-  [HIDD_LE_IDX_REPORT_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefFeature), sizeof(hidReportRefFeature), hidReportRefFeature } },
+  [HIDD_LE_IDX_REPORT_REP_REF] = { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid, ESP_GATT_PERM_READ, sizeof(hidReportRefFeature), sizeof(hidReportRefFeature), (uint8_t *)hidReportRefFeature } },
+#endif
 };
 
 static void hid_add_id_tbl(void);
@@ -431,6 +503,8 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
     ESP_LOGI(HID_LE_PRF_TAG, "HID connection establish, conn_id = %x", param->connect.conn_id);
     memcpy(cb_param.connect.remote_bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
     cb_param.connect.conn_id = param->connect.conn_id;
+    cb_param.connect.interval = param->connect.conn_params.interval;
+    cb_param.connect.latency = param->connect.conn_params.latency;
     hidd_clcb_alloc(param->connect.conn_id, param->connect.remote_bda);
     esp_ble_set_encryption(param->connect.remote_bda, ESP_BLE_SEC_ENCRYPT_NO_MITM);
     if (hidd_le_env.hidd_cb != NULL) {
@@ -440,7 +514,9 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
   }
   case ESP_GATTS_DISCONNECT_EVT: {
     if (hidd_le_env.hidd_cb != NULL) {
-      (hidd_le_env.hidd_cb)(ESP_HIDD_EVENT_BLE_DISCONNECT, NULL);
+      esp_hidd_cb_param_t cb_param = { 0 };
+      memcpy(cb_param.disconnect.remote_bda, param->disconnect.remote_bda, sizeof(esp_bd_addr_t));
+      (hidd_le_env.hidd_cb)(ESP_HIDD_EVENT_BLE_DISCONNECT, &cb_param);
     }
     hidd_clcb_dealloc(param->disconnect.conn_id);
     break;
@@ -449,6 +525,7 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
     break;
   case ESP_GATTS_WRITE_EVT: {
     esp_hidd_cb_param_t cb_param = { 0 };
+#if (SUPPORT_REPORT_LED == true)
     if (param->write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_LED_OUT_VAL]) {
       cb_param.led_write.conn_id = param->write.conn_id;
       cb_param.led_write.report_id = HID_RPT_ID_LED_OUT;
@@ -456,6 +533,7 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
       cb_param.led_write.data = param->write.value;
       (hidd_le_env.hidd_cb)(ESP_HIDD_EVENT_BLE_LED_REPORT_WRITE_EVT, &cb_param);
     }
+#endif
 #if (SUPPORT_REPORT_VENDOR == true)
     if (param->write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_VENDOR_OUT_VAL] &&
         hidd_le_env.hidd_cb != NULL) {
@@ -521,10 +599,10 @@ void hidd_clcb_alloc(uint16_t conn_id, esp_bd_addr_t bda) {
       p_clcb->conn_id = conn_id;
       p_clcb->connected = true;
       memcpy(p_clcb->remote_bda, bda, ESP_BD_ADDR_LEN);
-      break;
+      return;
     }
   }
-  return;
+  ESP_LOGE(HID_LE_PRF_TAG, "no free link control block for conn_id %d", conn_id);
 }
 
 bool hidd_clcb_dealloc(uint16_t conn_id) {
@@ -532,8 +610,10 @@ bool hidd_clcb_dealloc(uint16_t conn_id) {
   hidd_clcb_t *p_clcb = NULL;
 
   for (i_clcb = 0, p_clcb = hidd_le_env.hidd_clcb; i_clcb < HID_MAX_APPS; i_clcb++, p_clcb++) {
-    memset(p_clcb, 0, sizeof(hidd_clcb_t));
-    return true;
+    if (p_clcb->in_use && p_clcb->conn_id == conn_id) {
+      memset(p_clcb, 0, sizeof(hidd_clcb_t));
+      return true;
+    }
   }
 
   return false;
@@ -583,7 +663,7 @@ esp_err_t hidd_register_cb(void) {
 void hidd_set_attr_value(uint16_t handle, uint16_t val_len, const uint8_t *value) {
   hidd_inst_t *hidd_inst = &hidd_le_env.hidd_inst;
   if (hidd_inst->att_tbl[HIDD_LE_IDX_HID_INFO_VAL] <= handle &&
-      hidd_inst->att_tbl[HIDD_LE_IDX_REPORT_REP_REF] >= handle) {
+      hidd_inst->att_tbl[HIDD_LE_IDX_NB - 1] >= handle) {
     esp_ble_gatts_set_attr_value(handle, val_len, value);
   } else {
     ESP_LOGE(HID_LE_PRF_TAG, "%s error:Invalid handle value.", __func__);
@@ -594,7 +674,7 @@ void hidd_set_attr_value(uint16_t handle, uint16_t val_len, const uint8_t *value
 void hidd_get_attr_value(uint16_t handle, uint16_t *length, uint8_t **value) {
   hidd_inst_t *hidd_inst = &hidd_le_env.hidd_inst;
   if (hidd_inst->att_tbl[HIDD_LE_IDX_HID_INFO_VAL] <= handle &&
-      hidd_inst->att_tbl[HIDD_LE_IDX_REPORT_REP_REF] >= handle) {
+      hidd_inst->att_tbl[HIDD_LE_IDX_NB - 1] >= handle) {
     esp_ble_gatts_get_attr_value(handle, length, (const uint8_t **)value);
   } else {
     ESP_LOGE(HID_LE_PRF_TAG, "%s error:Invalid handle value.", __func__);
@@ -604,67 +684,17 @@ void hidd_get_attr_value(uint16_t handle, uint16_t *length, uint8_t **value) {
 }
 
 static void hid_add_id_tbl(void) {
-  // Mouse input report
-  hid_rpt_map[0].id = hidReportRefMouseIn[0];
-  hid_rpt_map[0].type = hidReportRefMouseIn[1];
-  hid_rpt_map[0].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_MOUSE_IN_VAL];
-  hid_rpt_map[0].cccdHandle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_MOUSE_IN_VAL];
-  hid_rpt_map[0].mode = HID_PROTOCOL_MODE_REPORT;
-
-  // Key input report
-  hid_rpt_map[1].id = hidReportRefKeyIn[0];
-  hid_rpt_map[1].type = hidReportRefKeyIn[1];
-  hid_rpt_map[1].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_KEY_IN_VAL];
-  hid_rpt_map[1].cccdHandle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_KEY_IN_CCC];
-  hid_rpt_map[1].mode = HID_PROTOCOL_MODE_REPORT;
-
-  // Consumer Control input report
-  hid_rpt_map[2].id = hidReportRefCCIn[0];
-  hid_rpt_map[2].type = hidReportRefCCIn[1];
-  hid_rpt_map[2].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_CC_IN_VAL];
-  hid_rpt_map[2].cccdHandle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_CC_IN_CCC];
-  hid_rpt_map[2].mode = HID_PROTOCOL_MODE_REPORT;
-
-  // LED output report
-  hid_rpt_map[3].id = hidReportRefLedOut[0];
-  hid_rpt_map[3].type = hidReportRefLedOut[1];
-  hid_rpt_map[3].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_LED_OUT_VAL];
-  hid_rpt_map[3].cccdHandle = 0;
-  hid_rpt_map[3].mode = HID_PROTOCOL_MODE_REPORT;
-
-  // Boot keyboard input report
-  // Use same ID and type as key input report
-  hid_rpt_map[4].id = hidReportRefKeyIn[0];
-  hid_rpt_map[4].type = hidReportRefKeyIn[1];
-  hid_rpt_map[4].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_BOOT_KB_IN_REPORT_VAL];
-  hid_rpt_map[4].cccdHandle = 0;
-  hid_rpt_map[4].mode = HID_PROTOCOL_MODE_BOOT;
-
-  // Boot keyboard output report
-  // Use same ID and type as LED output report
-  hid_rpt_map[5].id = hidReportRefLedOut[0];
-  hid_rpt_map[5].type = hidReportRefLedOut[1];
-  hid_rpt_map[5].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_BOOT_KB_OUT_REPORT_VAL];
-  hid_rpt_map[5].cccdHandle = 0;
-  hid_rpt_map[5].mode = HID_PROTOCOL_MODE_BOOT;
-
-  // Boot mouse input report
-  // Use same ID and type as mouse input report
-  hid_rpt_map[6].id = hidReportRefMouseIn[0];
-  hid_rpt_map[6].type = hidReportRefMouseIn[1];
-  hid_rpt_map[6].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_VAL];
-  hid_rpt_map[6].cccdHandle = 0;
-  hid_rpt_map[6].mode = HID_PROTOCOL_MODE_BOOT;
-
-  // Feature report
-  hid_rpt_map[7].id = hidReportRefFeature[0];
-  hid_rpt_map[7].type = hidReportRefFeature[1];
-  hid_rpt_map[7].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_VAL];
-  hid_rpt_map[7].cccdHandle = 0;
-  hid_rpt_map[7].mode = HID_PROTOCOL_MODE_REPORT;
+  for (int i = 0; i < HID_NUM_REPORTS; i++) {
+    hid_rpt_map[i].id = hid_rpt_defs[i].id;
+    hid_rpt_map[i].type = hid_rpt_defs[i].type;
+    hid_rpt_map[i].handle = hidd_le_env.hidd_inst.att_tbl[hid_rpt_defs[i].val_idx];
+    hid_rpt_map[i].cccdHandle = hid_rpt_defs[i].ccc_idx == HIDD_LE_IDX_SVC ? 0 : hidd_le_env.hidd_inst.att_tbl[hid_rpt_defs[i].ccc_idx];
+    hid_rpt_map[i].mode = hid_rpt_defs[i].mode;
+  }
 
   // Setup report ID map
   hid_dev_register_reports(HID_NUM_REPORTS, hid_rpt_map);
+  ESP_LOGI(HID_LE_PRF_TAG, "%d reports in %d HID service attributes", (int)HID_NUM_REPORTS, HIDD_LE_IDX_NB);
 }
 
 // Implementation of functions moved from hid_dev.c
@@ -696,7 +726,7 @@ void hid_dev_send_report(esp_gatt_if_t gatts_if, uint16_t conn_id,
   // get att handle for report
   if ((p_rpt = hid_dev_rpt_by_id(id, type)) != NULL) {
     // if notifications are enabled
-    ESP_LOGI(HID_LE_PRF_TAG, "%s(), send the report, handle = %d", __func__, p_rpt->handle);
+    ESP_LOGD(HID_LE_PRF_TAG, "%s(), send the report, handle = %d", __func__, p_rpt->handle);
     esp_ble_gatts_send_indicate(gatts_if, conn_id, p_rpt->handle, length, data, false);
   }
 
@@ -715,17 +745,24 @@ void hid_consumer_build_report(uint8_t *buffer, uint8_t cmd) {
   return;
 }
 
-void esp_hidd_send_battery_level(uint16_t conn_id, uint8_t level) {
+void esp_hidd_set_battery_level(uint8_t level) {
   if (bas_gatts_if == ESP_GATT_IF_NONE) {
     ESP_LOGE(HID_LE_PRF_TAG, "%s(), battery service not initialized", __func__);
     return;
   }
 
-  // Update the battery level value
+  // Update the battery level value, read by the host on its next request
   battary_lev = level;
-
-  // Set the attribute value in the GATT database
   esp_ble_gatts_set_attr_value(bas_handle_table[BAS_IDX_BATT_LVL_VAL], sizeof(uint8_t), &battary_lev);
+}
+
+void esp_hidd_send_battery_level(uint16_t conn_id, uint8_t level) {
+  if (bas_gatts_if == ESP_GATT_IF_NONE) {
+    ESP_LOGE(HID_LE_PRF_TAG, "%s(), battery service not initialized", __func__);
+    return;
+  }
+
+  esp_hidd_set_battery_level(level);
 
   // Send notification to the connected host
   esp_ble_gatts_send_indicate(bas_gatts_if, conn_id, bas_handle_table[BAS_IDX_BATT_LVL_VAL],
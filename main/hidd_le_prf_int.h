@@ -34,7 +34,13 @@ void hid_dev_send_report(esp_gatt_if_t gatts_if, uint16_t conn_id,
                         uint8_t id, uint8_t type, uint8_t length, uint8_t *data);
 void hid_consumer_build_report(uint8_t *buffer, uint8_t cmd);
 
-#define SUPPORT_REPORT_VENDOR                 false
+// Reports built into the HID service, every disabled one saves the host attributes to discover
+#define SUPPORT_REPORT_MOUSE                  false
+#define SUPPORT_REPORT_LED                    false
+#define SUPPORT_REPORT_FEATURE                false
+#define SUPPORT_REPORT_VENDOR                 true
+#define SUPPORT_BOOT_KEYBOARD                 true
+#define SUPPORT_BOOT_MOUSE                    false
 //HID BLE profile log tag
 #define HID_LE_PRF_TAG                        "HID_LE_PRF"
 
@@ -49,16 +55,15 @@ void hid_consumer_build_report(uint8_t *buffer, uint8_t cmd);
 #define HIDD_SUB_VER     0x00  //Version + Subversion
 #define HIDD_VERSION     ((HIDD_GREAT_VER<<8)|HIDD_SUB_VER)  //Version + Subversion
 
+// Simultaneous links, other bonded hosts stay disconnected until switched to
 #define HID_MAX_APPS                 1
 
-// Number of HID reports defined in the service
-#define HID_NUM_REPORTS          9
-
 // HID Report IDs for the service
 #define HID_RPT_ID_MOUSE_IN      1   // Mouse input report ID
 #define HID_RPT_ID_KEY_IN        2   // Keyboard input report ID
 #define HID_RPT_ID_CC_IN         3   //Consumer Control input report ID
 #define HID_RPT_ID_VENDOR_OUT    4   // Vendor output report ID
+#define HID_RPT_ID_VENDOR_IN     5   // Vendor input report ID
 #define HID_RPT_ID_LED_OUT       2  // LED output report ID
 #define HID_RPT_ID_FEATURE       0  // Feature report ID
 
@@ -140,31 +145,41 @@ enum {
     HIDD_LE_IDX_PROTO_MODE_VAL,
 
     // Report mouse input
+#if (SUPPORT_REPORT_MOUSE == true)
     HIDD_LE_IDX_REPORT_MOUSE_IN_CHAR,
     HIDD_LE_IDX_REPORT_MOUSE_IN_VAL,
     HIDD_LE_IDX_REPORT_MOUSE_IN_CCC,
     HIDD_LE_IDX_REPORT_MOUSE_REP_REF,
+#endif
     //Report Key input
     HIDD_LE_IDX_REPORT_KEY_IN_CHAR,
     HIDD_LE_IDX_REPORT_KEY_IN_VAL,
     HIDD_LE_IDX_REPORT_KEY_IN_CCC,
     HIDD_LE_IDX_REPORT_KEY_IN_REP_REF,
     ///Report Led output
+#if (SUPPORT_REPORT_LED == true)
     HIDD_LE_IDX_REPORT_LED_OUT_CHAR,
     HIDD_LE_IDX_REPORT_LED_OUT_VAL,
     HIDD_LE_IDX_REPORT_LED_OUT_REP_REF,
+#endif
 
 #if (SUPPORT_REPORT_VENDOR  == true)
     /// Report Vendor
     HIDD_LE_IDX_REPORT_VENDOR_OUT_CHAR,
     HIDD_LE_IDX_REPORT_VENDOR_OUT_VAL,
     HIDD_LE_IDX_REPORT_VENDOR_OUT_REP_REF,
+
+    HIDD_LE_IDX_REPORT_VENDOR_IN_CHAR,
+    HIDD_LE_IDX_REPORT_VENDOR_IN_VAL,
+    HIDD_LE_IDX_REPORT_VENDOR_IN_CCC,
+    HIDD_LE_IDX_REPORT_VENDOR_IN_REP_REF,
 #endif
     HIDD_LE_IDX_REPORT_CC_IN_CHAR,
     HIDD_LE_IDX_REPORT_CC_IN_VAL,
     HIDD_LE_IDX_REPORT_CC_IN_CCC,
     HIDD_LE_IDX_REPORT_CC_IN_REP_REF,
 
+#if (SUPPORT_BOOT_KEYBOARD == true)
     // Boot Keyboard Input Report
     HIDD_LE_IDX_BOOT_KB_IN_REPORT_CHAR,
     HIDD_LE_IDX_BOOT_KB_IN_REPORT_VAL,
@@ -173,17 +188,22 @@ enum {
     // Boot Keyboard Output Report
     HIDD_LE_IDX_BOOT_KB_OUT_REPORT_CHAR,
     HIDD_LE_IDX_BOOT_KB_OUT_REPORT_VAL,
+#endif
 
+#if (SUPPORT_BOOT_MOUSE == true)
     // Boot Mouse Input Report
     HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_CHAR,
     HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_VAL,
     HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_NTF_CFG,
+#endif
 
+#if (SUPPORT_REPORT_FEATURE == true)
     // Report
     HIDD_LE_IDX_REPORT_CHAR,
     HIDD_LE_IDX_REPORT_VAL,
     HIDD_LE_IDX_REPORT_REP_REF,
     //HIDD_LE_IDX_REPORT_NTF_CFG,
+#endif
 
     HIDD_LE_IDX_NB,
 };
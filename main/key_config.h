@@ -0,0 +1,42 @@
+#pragma once
+
+#include "board.h"
+
+// Set to 1 to fold the key configuration below into the per-sample key pipeline.
+// Runtime configuration changes are then ignored by the hot path.
+#define STATIC_KEY_CONFIG 0
+
+// Build-time key tuning, one entry per key of BOARD_KEYS and BOARD_MUX_KEYS
+// KEY_CONFIG(name, start deadzone, end deadzone, actuation distance, release distance,
+//            rapid trigger, continuous rapid trigger, rapid trigger actuation delta, rapid trigger release delta)
+#define KEY_CONFIGS(KEY_CONFIG)                    \
+  KEY_CONFIG(RIGHT, 17, 17, 128, 127, 1, 1, 31, 31) \
+  KEY_CONFIG(LEFT, 17, 17, 128, 127, 1, 1, 31, 31)  \
+  KEY_CONFIG(DOWN, 17, 17, 128, 127, 1, 1, 31, 31)  \
+  KEY_CONFIG(UP, 17, 17, 128, 127, 1, 1, 31, 31)
+
+// Named per-key constants, e.g. KEY_RIGHT_START_OFFSET or KEY_RIGHT_IS_INVERTED
+#define KEY_CONFIG_ENUM(name, start_offset, end_offset, actuation_distance, release_distance, ...) \
+  KEY_##name##_START_OFFSET = start_offset,                                                      \
+  KEY_##name##_END_OFFSET = end_offset,                                                          \
+  KEY_##name##_ACTUATION_DISTANCE = actuation_distance,                                          \
+  KEY_##name##_RELEASE_DISTANCE = release_distance,
+enum key_config_constants {
+  KEY_CONFIGS(KEY_CONFIG_ENUM)
+};
+
+#define KEY_POLARITY_ENUM(name, _unit_or_mux, _channel_or_address, polarity) \
+  KEY_##name##_IS_INVERTED = (polarity == NORTH_POLE_FACING_DOWN),
+enum key_polarity_constants {
+  BOARD_KEYS(KEY_POLARITY_ENUM)
+  BOARD_MUX_KEYS(KEY_POLARITY_ENUM)
+};
+
+// Time the switch chords below must be held before they act
+#define CHORD_HOLD_MS 1000
+
+// Keys to hold together to switch to the next stored profile
+#define PROFILE_SWITCH_CHORD ((1 << KEY_UP) | (1 << KEY_DOWN))
+
+// Keys to hold together to switch to the next host slot
+#define HOST_SWITCH_CHORD ((1 << KEY_LEFT) | (1 << KEY_RIGHT))
@@ -0,0 +1,125 @@
+#include "keymap.h"
+#include "esp_log.h"
+#include "hid.h"
+#include "main.h"
+#include <string.h>
+
+static const char *TAG = "KEYMAP";
+
+// Layer 0 is always active, higher layers take precedence over lower ones
+const uint16_t default_keymap[LAYERS_COUNT][KEYS_COUNT] = {
+  [0] = {
+      [KEY_RIGHT] = KC(HID_KEY_RIGHT),
+      [KEY_LEFT] = KC(HID_KEY_LEFT),
+      [KEY_DOWN] = KC(HID_KEY_DOWN),
+      [KEY_UP] = KC(HID_KEY_UP),
+  },
+};
+
+// Points into the active configuration once a profile is loaded
+static const uint16_t (*keymap)[KEYS_COUNT] = default_keymap;
+
+static uint32_t momentary_layers = 0;
+static uint32_t toggled_layers = 0;
+static uint32_t oneshot_layers = 0;
+
+// Action of the top-most non-transparent layer for each key, rebuilt on layer change
+static uint16_t resolved_actions[KEYS_COUNT] = { 0 };
+// Action latched when the key was pressed, so a layer change never strands a held key
+static uint16_t pressed_actions[KEYS_COUNT] = { 0 };
+
+static void resolve_layers() {
+  uint32_t layer_state = keymap_get_layer_state();
+
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    resolved_actions[i] = KC_NO;
+    for (int layer = LAYERS_COUNT - 1; layer >= 0; layer--) {
+      if ((layer_state & (1 << layer)) && keymap[layer][i] != KC_TRNS) {
+        resolved_actions[i] = keymap[layer][i];
+        break;
+      }
+    }
+  }
+
+  ESP_LOGD(TAG, "layer state is 0x%02" PRIx32, layer_state);
+}
+
+void keymap_init() {
+  momentary_layers = 0;
+  toggled_layers = 0;
+  oneshot_layers = 0;
+  memset(pressed_actions, 0, sizeof(pressed_actions));
+  resolve_layers();
+}
+
+void keymap_set_layers(const uint16_t layers[LAYERS_COUNT][KEYS_COUNT]) {
+  keymap = layers;
+  resolve_layers();
+}
+
+void keymap_press(uint8_t key) {
+  uint16_t action = resolved_actions[key];
+  uint8_t layer = ACTION_ARG(action) % LAYERS_COUNT;
+  pressed_actions[key] = action;
+
+  switch (ACTION_KIND(action)) {
+  case ACTION_KIND_KEYCODE:
+    // Any regular key press consumes the one-shot layer
+    if (oneshot_layers) {
+      oneshot_layers = 0;
+      resolve_layers();
+    }
+    break;
+  case ACTION_KIND_LAYER_MOMENTARY:
+    momentary_layers |= (1 << layer);
+    resolve_layers();
+    break;
+  case ACTION_KIND_LAYER_TOGGLE:
+    toggled_layers ^= (1 << layer);
+    resolve_layers();
+    break;
+  case ACTION_KIND_LAYER_ONESHOT:
+    oneshot_layers |= (1 << layer);
+    resolve_layers();
+    break;
+  default:
+    break;
+  }
+}
+
+void keymap_release(uint8_t key) {
+  uint16_t action = pressed_actions[key];
+  pressed_actions[key] = 0;
+
+  if (ACTION_KIND(action) == ACTION_KIND_LAYER_MOMENTARY) {
+    momentary_layers &= ~(1 << (ACTION_ARG(action) % LAYERS_COUNT));
+    resolve_layers();
+  }
+}
+
+uint8_t keymap_get_keycode(uint8_t key) {
+  if (ACTION_KIND(pressed_actions[key]) != ACTION_KIND_KEYCODE) {
+    return 0;
+  }
+  return ACTION_ARG(pressed_actions[key]);
+}
+
+bool keymap_is_valid_action(uint16_t action) {
+  switch (ACTION_KIND(action)) {
+  case ACTION_KIND_KEYCODE:
+    return true;
+  case ACTION_KIND_LAYER_MOMENTARY:
+  case ACTION_KIND_LAYER_TOGGLE:
+  case ACTION_KIND_LAYER_ONESHOT:
+    // The base layer is always active
+    return ACTION_ARG(action) > 0 && ACTION_ARG(action) < LAYERS_COUNT;
+  case ACTION_KIND_NONE:
+    return action == KC_NO;
+  default:
+    return false;
+  }
+}
+
+uint32_t keymap_get_layer_state() {
+  return 1 | momentary_layers | toggled_layers | oneshot_layers;
+}
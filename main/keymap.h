@@ -0,0 +1,72 @@
+#pragma once
+
+#include "board.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LAYERS_COUNT 8
+
+// A key action is 16 bits wide: the high byte is the action kind, the low
+// byte its argument (HID keycode or layer index)
+#define ACTION(kind, arg) ((uint16_t)(((kind) << 8) | ((arg) & 0xFF)))
+#define ACTION_KIND(action) ((action) >> 8)
+#define ACTION_ARG(action) ((action) & 0xFF)
+
+enum action_kind {
+  ACTION_KIND_KEYCODE = 0x00,
+  ACTION_KIND_LAYER_MOMENTARY = 0x01,
+  ACTION_KIND_LAYER_TOGGLE = 0x02,
+  ACTION_KIND_LAYER_ONESHOT = 0x03,
+  ACTION_KIND_NONE = 0xFF,
+};
+
+// Falls through to the next active layer below (zero so empty layers are transparent)
+#define KC_TRNS ACTION(ACTION_KIND_KEYCODE, 0)
+// Blocks lower layers and does nothing
+#define KC_NO ACTION(ACTION_KIND_NONE, 0)
+#define KC(keycode) ACTION(ACTION_KIND_KEYCODE, keycode)
+// Layer is active while the key is held
+#define MO(layer) ACTION(ACTION_KIND_LAYER_MOMENTARY, layer)
+// Layer is switched on/off on each press
+#define TG(layer) ACTION(ACTION_KIND_LAYER_TOGGLE, layer)
+// Layer is active for the next key press only
+#define OSL(layer) ACTION(ACTION_KIND_LAYER_ONESHOT, layer)
+
+// Build-time keymap, used until a profile provides its own
+extern const uint16_t default_keymap[LAYERS_COUNT][KEYS_COUNT];
+
+void keymap_init(void);
+
+/**
+ * @brief Switch to another set of layers, keys already pressed keep their latched action
+ * @param layers Must stay valid until the next call
+ */
+void keymap_set_layers(const uint16_t layers[LAYERS_COUNT][KEYS_COUNT]);
+
+/**
+ * @brief Latch the action bound to a key on the active layers and apply it
+ * @param key Key index
+ */
+void keymap_press(uint8_t key);
+
+/**
+ * @brief Release the action latched by keymap_press
+ * @param key Key index
+ */
+void keymap_release(uint8_t key);
+
+/**
+ * @brief Get the HID keycode latched for a pressed key
+ * @return HID keycode, 0 when the key is released or bound to a non-keycode action
+ */
+uint8_t keymap_get_keycode(uint8_t key);
+
+/**
+ * @brief Check an action word is one of the kinds above with an argument it accepts
+ */
+bool keymap_is_valid_action(uint16_t action);
+
+/**
+ * @brief Get the bitmask of active layers (bit 0 is the base layer)
+ */
+uint32_t keymap_get_layer_state(void);
@@ -0,0 +1,86 @@
+#include "link_sync.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <inttypes.h>
+
+static const char *TAG = "LINK_SYNC";
+
+#define LINK_SYNC_STATS_PERIOD_US (5 * 1000 * 1000)
+
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t interval_us = 0;
+static int64_t last_frame_at = 0;
+
+// Report latency over the current stats window, only touched by the report task
+static uint64_t latency_sum_us = 0;
+static uint32_t latency_count = 0;
+static uint64_t event_latency_sum_us = 0;
+static uint32_t event_count = 0;
+static int64_t stats_started_at = 0;
+static struct link_sync_stats stats = { 0 };
+
+void link_sync_set_interval(uint32_t new_interval_us, uint16_t latency) {
+  taskENTER_CRITICAL(&lock);
+  interval_us = new_interval_us;
+  taskEXIT_CRITICAL(&lock);
+
+  ESP_LOGI(TAG, "connection interval %" PRIu32 " us, latency %d", new_interval_us, latency);
+}
+
+void link_sync_on_frame(int64_t sampled_at) {
+  taskENTER_CRITICAL(&lock);
+  last_frame_at = sampled_at;
+  taskEXIT_CRITICAL(&lock);
+}
+
+static void publish_stats(int64_t now) {
+  stats.latency_avg_us = latency_count > 0 ? latency_sum_us / latency_count : 0;
+  stats.event_latency_avg_us = event_count > 0 ? event_latency_sum_us / event_count : 0;
+  ESP_LOGI(TAG, "report queue latency avg %" PRIu32 " us, max %" PRIu32 " us over %" PRIu32 " reports, interval %" PRIu32 " us",
+           stats.latency_avg_us, stats.latency_max_us, latency_count, stats.interval_us);
+  ESP_LOGI(TAG, "key event queue latency avg %" PRIu32 " us, max %" PRIu32 " us over %" PRIu32 " events",
+           stats.event_latency_avg_us, stats.event_latency_max_us, event_count);
+
+  latency_sum_us = 0;
+  latency_count = 0;
+  event_latency_sum_us = 0;
+  event_count = 0;
+  stats_started_at = now;
+}
+
+void link_sync_on_report_sent(int64_t sent_at, bool has_event, uint32_t event_at) {
+  taskENTER_CRITICAL(&lock);
+  int64_t frame_at = last_frame_at;
+  uint32_t interval = interval_us;
+  taskEXIT_CRITICAL(&lock);
+
+  if (stats_started_at == 0) {
+    stats_started_at = sent_at;
+  }
+
+  uint32_t latency_us = sent_at - frame_at;
+  if (latency_count == 0 || latency_us > stats.latency_max_us) {
+    stats.latency_max_us = latency_us;
+  }
+  latency_sum_us += latency_us;
+  latency_count++;
+
+  if (has_event) {
+    uint32_t event_latency_us = (uint32_t)sent_at - event_at;
+    if (event_count == 0 || event_latency_us > stats.event_latency_max_us) {
+      stats.event_latency_max_us = event_latency_us;
+    }
+    event_latency_sum_us += event_latency_us;
+    event_count++;
+  }
+
+  stats.interval_us = interval;
+  if (sent_at - stats_started_at >= LINK_SYNC_STATS_PERIOD_US) {
+    publish_stats(sent_at);
+  }
+}
+
+void link_sync_get_stats(struct link_sync_stats *link_stats) {
+  *link_stats = stats;
+}
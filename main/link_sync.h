@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Bluedroid exposes no connection event timing, so latency is measured up to the report being queued to the
+// stack; the report then waits up to one connection interval, more with peripheral latency, to go on air
+struct link_sync_stats {
+  uint32_t interval_us;
+  // Time from the sample behind a report to the report being queued, over the last stats window
+  uint32_t latency_avg_us;
+  uint32_t latency_max_us;
+  // Time from the interpolated key actuation or release behind a report to the report being queued
+  uint32_t event_latency_avg_us;
+  uint32_t event_latency_max_us;
+};
+
+/**
+ * @brief Track a new connection interval, 0 once disconnected
+ * @param latency Peripheral latency, only logged
+ */
+void link_sync_set_interval(uint32_t interval_us, uint16_t latency);
+
+/**
+ * @brief Record a processed frame, the sample reports built from now on come from
+ */
+void link_sync_on_frame(int64_t sampled_at);
+
+/**
+ * @brief Record a report queued to the stack, from the latest processed frame
+ * @param has_event Whether the report carries a key event
+ * @param event_at Earliest key event carried, in the keys_state time base
+ */
+void link_sync_on_report_sent(int64_t sent_at, bool has_event, uint32_t event_at);
+
+void link_sync_get_stats(struct link_sync_stats *stats);
@@ -1,186 +1,396 @@
 #include "main.h"
+#include "battery.h"
+#include "benchmark.h"
+#include "config.h"
+#include "crosstalk.h"
+#include "drift.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
 #include "hid.h"
+#include "key_config.h"
+#include "keymap.h"
+#include "link_sync.h"
+#include "noise.h"
+#include "power.h"
+#include "profile.h"
 #include "sdkconfig.h"
 #include "sensor.h"
+#include "vendor.h"
 #include <stdio.h>
 #include <string.h>
 
 static const char *TAG = "LIBERTY_PAD";
 
-#define KEYS_COUNT 4
-#define ADC_VREF 3300
-#define MAX_DISTANCE_PRE_CALIBRATION 500
 #define MIN_TIME_BETWEEN_DIRECTION_CHANGE_MS 100
+// Crossings are interpolated between two samples at most this far apart, twice the time an active scan
+// takes to come back to a key; anything longer spans frames the key engine never saw
+#define KEY_CROSSING_MAX_SPAN_US (2 * MUX_ADDRESS_COUNT * portTICK_PERIOD_MS * 1000)
 
-const uint32_t adc_channels[ADC_CHANNEL_COUNT] = {
-  ADC_CHANNEL_3,
-  ADC_CHANNEL_4,
-  ADC_CHANNEL_5,
-  ADC_CHANNEL_6,
-  ADC_CHANNEL_0, // Battery voltage on ADC_CHANNEL_0
-};
-
+struct keys_state keys_state = { 0 };
 struct key keys[KEYS_COUNT] = { 0 };
 
 void init_keys() {
-  for (int i = 0; i < KEYS_COUNT; i++) {
-    keys[i].config.hardware.adc_channel = adc_channels[i];
-    keys[i].config.hardware.magnet_polarity = NORTH_POLE_FACING_DOWN;
-
-    keys[i].config.deadzones.start_offset = 17;
-    keys[i].config.deadzones.end_offset = 17;
-    keys[i].config.actuation_distance = 128;
-    keys[i].config.release_distance = 127;
-
-    keys[i].config.rapid_trigger.is_enabled = 1;
-    keys[i].config.rapid_trigger.is_continuous = 1;
-    keys[i].config.rapid_trigger.actuation_distance_delta = 31;
-    keys[i].config.rapid_trigger.release_distance_delta = 31;
-
-    keys[i].calibration.max_distance = MAX_DISTANCE_PRE_CALIBRATION;
-    keys[i].status = STATUS_RESET;
-  }
-  keys[0].config.hardware.adc_channel = ADC_CHANNEL_3;
-  keys[0].config.keycode = HID_KEY_RIGHT;
-  keys[1].config.hardware.adc_channel = ADC_CHANNEL_4;
-  keys[1].config.keycode = HID_KEY_LEFT;
-  keys[2].config.hardware.adc_channel = ADC_CHANNEL_5;
-  keys[2].config.keycode = HID_KEY_DOWN;
-  keys[3].config.hardware.adc_channel = ADC_CHANNEL_6;
-  keys[3].config.keycode = HID_KEY_UP;
-}
-
-void update_key_state(adc_channel_t adc_channel, uint16_t raw_value) {
-  struct key_state new_state = { 0 };
-
-  uint16_t normalized_value = 0;
-  if (keys[adc_channel].config.hardware.magnet_polarity == NORTH_POLE_FACING_DOWN) {
-    normalized_value = ADC_VREF - raw_value;
-  } else {
-    normalized_value = raw_value;
+  config_init();
+  profile_init();
+  const struct keys_config *config = config_acquire(CONFIG_READER_SCAN);
+  init_keys_state(&keys_state, config->keys, KEYS_COUNT);
+}
+
+static void set_max_distance(struct keys_state *state, int i, uint16_t max_distance) {
+  state->max_distance[i] = max_distance;
+  state->scale[i] = (255 << 16) / max_distance;
+}
+
+void set_key_calibration(struct keys_state *state, int i, uint16_t idle_value, uint16_t max_distance) {
+  state->idle_value[i] = idle_value;
+  if (max_distance != state->max_distance[i]) {
+    set_max_distance(state, i, max_distance);
+  }
+}
+
+void apply_keys_config(struct keys_state *state, const struct key_config *configs, int count) {
+  for (int i = 0; i < count; i++) {
+    state->start_offset[i] = configs[i].deadzones.start_offset;
+    state->end_offset[i] = configs[i].deadzones.end_offset;
+    state->is_inverted[i] = configs[i].hardware.magnet_polarity == NORTH_POLE_FACING_DOWN;
+    state->is_tracked[i] = KEY_TRACKER_ENABLED;
+    state->actuation_distance[i] = configs[i].actuation_distance;
+    state->release_distance[i] = configs[i].release_distance;
   }
+}
 
-  // new_state.raw_adc_value = normalized_value;
+void init_keys_state(struct keys_state *state, const struct key_config *configs, int count) {
+  apply_keys_config(state, configs, count);
+  for (int i = 0; i < count; i++) {
+    state->idle_value[i] = 0;
+    set_max_distance(state, i, MAX_DISTANCE_PRE_CALIBRATION);
+    state->distance[i] = 0;
+    state->is_idle[i] = 0;
+    state->status[i] = STATUS_RESET;
+    state->tracked_position[i] = 0;
+    state->tracked_velocity[i] = 0;
+    state->sampled_at[i] = 0;
+    state->actuated_at[i] = 0;
+    state->released_at[i] = 0;
+  }
+}
 
-  // Initial calibration of IDLE value
-  // Only for the first 2 seconds after task start
-  if (xTaskGetTickCount() < pdMS_TO_TICKS(1000)) {
-    if (keys[adc_channel].calibration.idle_value == 0) {
-      keys[adc_channel].calibration.idle_value = normalized_value;
-    } else {
-      float delta = 0.6;
-      keys[adc_channel].calibration.idle_value = (1 - delta) * normalized_value + delta * keys[adc_channel].calibration.idle_value;
-    }
+// Predict from the last estimate, then correct position and velocity by a share of the residual
+static inline __attribute__((always_inline)) uint16_t
+track_key(struct keys_state *state, int i, uint16_t measured_value, uint8_t is_calibrating) {
+  int32_t measured = (int32_t)measured_value << KEY_TRACKER_SHIFT;
+  if (is_calibrating) {
+    state->tracked_position[i] = measured;
+    state->tracked_velocity[i] = 0;
+    return measured_value;
+  }
 
-    keys[adc_channel].state = new_state;
+  int32_t predicted = state->tracked_position[i] + state->tracked_velocity[i];
+  int32_t residual = measured - predicted;
+  int32_t position = predicted + ((residual * KEY_TRACKER_ALPHA) >> KEY_TRACKER_GAIN_SHIFT);
+  state->tracked_velocity[i] += (residual * KEY_TRACKER_BETA) >> KEY_TRACKER_GAIN_SHIFT;
+
+  if (position < 0) {
+    position = 0;
+  } else if (position > ((int32_t)ADC_VREF << KEY_TRACKER_SHIFT)) {
+    position = (int32_t)ADC_VREF << KEY_TRACKER_SHIFT;
+  }
+  state->tracked_position[i] = position;
+  return (position + (1 << (KEY_TRACKER_SHIFT - 1))) >> KEY_TRACKER_SHIFT;
+}
+
+// Time at which the travel crossed a threshold lying covered distance units past the previous sample,
+// out of span units up to this one. Without a recent previous sample, such as on the frame waking
+// from idle, the crossing is stamped with this sample.
+static inline uint32_t interpolate_crossing(uint32_t previous_at, uint32_t at, uint32_t covered, uint32_t span) {
+  if (at - previous_at > KEY_CROSSING_MAX_SPAN_US) {
+    return at;
+  }
+  return previous_at + (at - previous_at) * covered / span;
+}
+
+// Shared by the runtime loop and the specialized pipeline; forced inline so
+// constant configuration arguments fold away
+static inline __attribute__((always_inline)) void
+update_key_state(struct keys_state *state, int i, uint16_t raw_value, uint32_t sampled_at, uint8_t is_calibrating,
+                 uint8_t is_inverted, uint8_t is_tracked, uint8_t start_offset, uint8_t end_offset,
+                 uint8_t actuation_distance, uint8_t release_distance) {
+  uint16_t normalized_value = is_inverted ? ADC_VREF - raw_value : raw_value;
+  if (is_tracked) {
+    normalized_value = track_key(state, i, normalized_value, is_calibrating);
+  }
+  uint16_t idle_value = state->idle_value[i];
+  uint32_t previous_sampled_at = state->sampled_at[i];
+  state->normalized_value[i] = normalized_value;
+  state->sampled_at[i] = sampled_at;
+
+  // Initial calibration of IDLE value
+  if (is_calibrating) {
+    state->idle_value[i] = idle_value == 0 ? normalized_value : (2 * normalized_value + 3 * idle_value) / 5;
+    state->distance[i] = 0;
     return;
   }
 
   // Calibrate idle value
-  if (normalized_value < keys[adc_channel].calibration.idle_value) {
-    float delta = 0.8;
-    keys[adc_channel].calibration.idle_value = (1 - delta) * normalized_value + delta * keys[adc_channel].calibration.idle_value;
+  if (normalized_value < idle_value) {
+    idle_value = (normalized_value + 4 * idle_value) / 5;
+    state->idle_value[i] = idle_value;
   }
 
-  uint16_t distance = 0;
   // Get distance
-  if (normalized_value > keys[adc_channel].calibration.idle_value) {
-    distance = normalized_value - keys[adc_channel].calibration.idle_value;
-  } else {
-    distance = 0;
-  }
+  uint16_t distance = normalized_value > idle_value ? normalized_value - idle_value : 0;
 
   // Calibrate max distance value
-  if (distance > keys[adc_channel].calibration.max_distance) {
-    keys[adc_channel].calibration.max_distance = distance;
+  if (distance > state->max_distance[i]) {
+    set_max_distance(state, i, distance);
   }
 
   // Get 8-bit distance
-  if (distance >= keys[adc_channel].calibration.max_distance - keys[adc_channel].config.deadzones.end_offset) {
-    new_state.distance = 255;
-    keys[adc_channel].is_idle = 0;
-  } else if (distance <= keys[adc_channel].config.deadzones.start_offset) {
-    new_state.distance = 0;
+  uint8_t previous_distance = state->distance[i];
+  uint8_t scaled_distance;
+  if (distance + end_offset >= state->max_distance[i]) {
+    scaled_distance = 255;
+    state->is_idle[i] = 0;
+  } else if (distance <= start_offset) {
+    scaled_distance = 0;
+    state->is_idle[i] = 1;
   } else {
-    new_state.distance = (distance * 255) / keys[adc_channel].calibration.max_distance;
-    keys[adc_channel].is_idle = 0;
+    scaled_distance = (distance * state->scale[i]) >> 16;
+    state->is_idle[i] = 0;
+  }
+  state->distance[i] = scaled_distance;
+
+  // Stamp threshold crossings between the samples around them rather than when they get noticed
+  if (previous_distance < actuation_distance && scaled_distance >= actuation_distance) {
+    state->actuated_at[i] = interpolate_crossing(previous_sampled_at, sampled_at, actuation_distance - previous_distance,
+                                                 scaled_distance - previous_distance);
+  } else if (previous_distance > release_distance && scaled_distance <= release_distance) {
+    state->released_at[i] = interpolate_crossing(previous_sampled_at, sampled_at, previous_distance - release_distance,
+                                                 previous_distance - scaled_distance);
+  }
+}
+
+void update_keys_state(struct keys_state *state, const uint16_t *raw_values, const uint32_t *sampled_at, int count,
+                       uint8_t is_calibrating) {
+  for (int i = 0; i < count; i++) {
+    update_key_state(state, i, raw_values[i], sampled_at[i], is_calibrating,
+                     state->is_inverted[i], state->is_tracked[i], state->start_offset[i], state->end_offset[i],
+                     state->actuation_distance[i], state->release_distance[i]);
+  }
+}
+
+// Keys behind the multiplexer addresses not scanned this frame keep their state until sampled again
+static void update_sampled_keys_state(struct keys_state *state, const uint16_t *raw_values, const uint32_t *sampled_at,
+                                      uint32_t sampled_keys, uint8_t is_calibrating) {
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    if (sampled_keys & (1 << i)) {
+      update_key_state(state, i, raw_values[i], sampled_at[i], is_calibrating,
+                       state->is_inverted[i], state->is_tracked[i], state->start_offset[i], state->end_offset[i],
+                       state->actuation_distance[i], state->release_distance[i]);
+    }
+  }
+}
+
+#if STATIC_KEY_CONFIG
+#define UPDATE_STATIC_KEY_STATE(name, ...)                                                                        \
+  update_key_state(state, KEY_##name, raw_values[KEY_##name], sampled_at[KEY_##name], is_calibrating,        \
+                   KEY_##name##_IS_INVERTED, KEY_TRACKER_ENABLED, KEY_##name##_START_OFFSET,                 \
+                   KEY_##name##_END_OFFSET, KEY_##name##_ACTUATION_DISTANCE, KEY_##name##_RELEASE_DISTANCE);
+// Direct keys are sampled on every frame
+#define UPDATE_STATIC_MUX_KEY_STATE(name, ...) \
+  if (sampled_keys & (1 << KEY_##name)) {      \
+    UPDATE_STATIC_KEY_STATE(name)              \
+  }
+
+// One unrolled step per key with its configuration as immediate constants
+static void update_static_keys_state(struct keys_state *state, const uint16_t *raw_values, const uint32_t *sampled_at,
+                                     uint32_t sampled_keys, uint8_t is_calibrating) {
+  BOARD_KEYS(UPDATE_STATIC_KEY_STATE)
+  BOARD_MUX_KEYS(UPDATE_STATIC_MUX_KEY_STATE)
+}
+#endif
+
+void process_key_frame(const uint16_t raw_values[KEYS_COUNT], const uint32_t sampled_at[KEYS_COUNT],
+                       uint32_t sampled_keys) {
+  // Pick up a newly published configuration between two frames, never in the middle of one
+  static uint32_t applied_version = 0;
+  const struct keys_config *config = config_acquire(CONFIG_READER_SCAN);
+  if (config->version != applied_version) {
+    apply_keys_config(&keys_state, config->keys, KEYS_COUNT);
+    noise_apply_deadzones(&keys_state, KEYS_COUNT);
+    applied_version = config->version;
   }
 
-  keys[adc_channel].state = new_state;
+  // Only for the first second after task start
+  uint8_t is_calibrating = xTaskGetTickCount() < pdMS_TO_TICKS(1000);
+  if (!is_calibrating) {
+    drift_apply(&keys_state, KEYS_COUNT);
+  }
+#if STATIC_KEY_CONFIG
+  update_static_keys_state(&keys_state, raw_values, sampled_at, sampled_keys, is_calibrating);
+#else
+  update_sampled_keys_state(&keys_state, raw_values, sampled_at, sampled_keys, is_calibrating);
+  if (!is_calibrating) {
+    noise_update(&keys_state, KEYS_COUNT, sampled_keys);
+  }
+#endif
+  if (!is_calibrating) {
+    drift_observe(&keys_state, KEYS_COUNT, sampled_keys);
+  }
 }
 
-void update_key_direction(struct key *key) {
+void update_key_direction(struct key *key, uint8_t is_tracked, int32_t tracked_velocity) {
+  // The tracker velocity gives the travel direction, kept as is through its deadband
+  if (is_tracked) {
+    if (tracked_velocity > KEY_TRACKER_DIRECTION_DEADBAND) {
+      key->direction = DOWN;
+    } else if (tracked_velocity < -KEY_TRACKER_DIRECTION_DEADBAND) {
+      key->direction = UP;
+    }
+  }
+
   // // Update velocity
-  // new_state.velocity = new_state.distance - keys[adc_channel].state.distance;
+  // new_state.velocity = new_state.distance - keys[key_index].state.distance;
 
-  // new_state.acceleration = new_state.velocity - keys[adc_channel].state.velocity;
-  // new_state.jerk = new_state.acceleration - keys[adc_channel].state.acceleration;
+  // new_state.acceleration = new_state.velocity - keys[key_index].state.velocity;
+  // new_state.jerk = new_state.acceleration - keys[key_index].state.acceleration;
 
   // // This should be moved in another function dedicated to update the direction and trigger/reset state. Maybe some state machine?
   // // Not needed for this project as everykey is mutually exclusive (kind of SOCD)
-  // enum key_direction previous_direction = keys[adc_channel].direction;
+  // enum key_direction previous_direction = keys[key_index].direction;
   // // Update direction
   // if (new_state.distance == 0) {
-  //   keys[adc_channel].direction = UP;
-  //   // keys[adc_channel].from = 0;
+  //   keys[key_index].direction = UP;
+  //   // keys[key_index].from = 0;
   // }
-  // if (keys[adc_channel].since == 0 || xTaskGetTickCount() - keys[adc_channel].since > pdMS_TO_TICKS(MIN_TIME_BETWEEN_DIRECTION_CHANGE_MS)) {
-  //   if (new_state.velocity > 0 && keys[adc_channel].state.velocity > 0 && keys[adc_channel].direction != DOWN) {
-  //     keys[adc_channel].direction = DOWN;
-  //     // if (keys[adc_channel].state.from != 0) {
-  //     //   keys[adc_channel].from = keys[adc_channel].state.distance;
+  // if (keys[key_index].since == 0 || xTaskGetTickCount() - keys[key_index].since > pdMS_TO_TICKS(MIN_TIME_BETWEEN_DIRECTION_CHANGE_MS)) {
+  //   if (new_state.velocity > 0 && keys[key_index].state.velocity > 0 && keys[key_index].direction != DOWN) {
+  //     keys[key_index].direction = DOWN;
+  //     // if (keys[key_index].state.from != 0) {
+  //     //   keys[key_index].from = keys[key_index].state.distance;
   //     // }
-  //   } else if (new_state.velocity < 0 && keys[adc_channel].state.velocity > 0 && keys[adc_channel].direction != UP) {
-  //     keys[adc_channel].direction = UP;
-  //     // if (keys[adc_channel].state.from != 255) {
-  //     //   keys[adc_channel].from = keys[adc_channel].state.distance;
+  //   } else if (new_state.velocity < 0 && keys[key_index].state.velocity > 0 && keys[key_index].direction != UP) {
+  //     keys[key_index].direction = UP;
+  //     // if (keys[key_index].state.from != 255) {
+  //     //   keys[key_index].from = keys[key_index].state.distance;
   //     // }
   //   }
   // }
-  // if (keys[adc_channel].direction != previous_direction || new_state.distance == 0) {
-  //   keys[adc_channel].since = xTaskGetTickCount();
+  // if (keys[key_index].direction != previous_direction || new_state.distance == 0) {
+  //   keys[key_index].since = xTaskGetTickCount();
   // }
 }
 
+// A switch chord acts once all its keys have been held together for CHORD_HOLD_MS, so keys briefly
+// overlapping in normal use never trigger it. Its keys then stay out of the reports until released.
+struct chord {
+  uint32_t keys;
+  void (*action)(void);
+  bool is_held;
+  bool has_fired;
+  TickType_t held_since;
+};
+
+static struct chord chords[] = {
+  { .keys = PROFILE_SWITCH_CHORD, .action = profile_request_next },
+  { .keys = HOST_SWITCH_CHORD, .action = hid_select_next_host },
+};
+
+static uint32_t suppressed_keys = 0;
+
+static void update_chords(uint32_t pressed_keys, TickType_t now) {
+  for (int i = 0; i < sizeof(chords) / sizeof(chords[0]); i++) {
+    struct chord *chord = &chords[i];
+    if ((pressed_keys & chord->keys) != chord->keys) {
+      chord->is_held = false;
+      chord->has_fired = false;
+      continue;
+    }
+
+    if (!chord->is_held) {
+      chord->is_held = true;
+      chord->held_since = now;
+    }
+    if (!chord->has_fired && now - chord->held_since >= pdMS_TO_TICKS(CHORD_HOLD_MS)) {
+      chord->has_fired = true;
+      suppressed_keys |= chord->keys;
+      chord->action();
+    }
+  }
+  suppressed_keys &= pressed_keys;
+}
+
 void update_keys(void *pvParameters) {
+  uint32_t applied_version = 0;
+  uint32_t pressed_keys = 0;
+  // Earliest key event not carried by a report yet
+  bool has_pending_event = false;
+  uint32_t pending_event_at = 0;
+
   while (1) {
     static uint8_t should_send_report = 0;
 
     uint8_t keycodes[6] = { 0 };
     uint8_t keycodes_length = 0;
+    const struct keys_config *config = config_acquire(CONFIG_READER_KEYS);
+    if (config->version != applied_version) {
+      keymap_set_layers(config->keymap);
+      applied_version = config->version;
+    }
+    uint32_t previously_pressed_keys = pressed_keys;
 
-    for (int i = 0; i < ADC_CHANNEL_COUNT; i++) {
-      update_key_direction(&keys[i]);
+    for (int i = 0; i < KEYS_COUNT; i++) {
+      update_key_direction(&keys[i], keys_state.is_tracked[i], keys_state.tracked_velocity[i]);
 
-      switch (keys[i].status) {
+      switch (keys_state.status[i]) {
       case STATUS_RESET:
-        if (keys[i].state.distance >= keys[i].config.actuation_distance) {
-          keys[i].status = STATUS_TRIGGERED;
-          keys[i].triggered_at = xTaskGetTickCount();
+        if (keys_state.distance[i] >= config->keys[i].actuation_distance) {
+          keys_state.status[i] = STATUS_TRIGGERED;
+          keys[i].triggered_at = keys_state.actuated_at[i];
+          keys[i].press_count++;
+          keymap_press(i);
+          pressed_keys |= (1 << i);
         }
         break;
       case STATUS_TRIGGERED:
-        if (keys[i].state.distance <= keys[i].config.release_distance) {
-          keys[i].status = STATUS_RESET;
-          keys[i].triggered_at = 0;
+        if (keys_state.distance[i] <= config->keys[i].release_distance) {
+          keys_state.status[i] = STATUS_RESET;
+          keys[i].released_at = keys_state.released_at[i];
+          keymap_release(i);
+          pressed_keys &= ~(1 << i);
         }
         break;
       default:
         break;
       }
+    }
 
-      if (keys[i].status == STATUS_TRIGGERED) {
-        keycodes[keycodes_length] = keys[i].config.keycode;
+    update_chords(pressed_keys, xTaskGetTickCount());
+
+    for (int i = 0; i < KEYS_COUNT; i++) {
+      uint8_t keycode = suppressed_keys & (1 << i) ? 0 : keymap_get_keycode(i);
+      if (keycode != 0 && keycodes_length < sizeof(keycodes)) {
+        keycodes[keycodes_length] = keycode;
         keycodes_length++;
       }
     }
 
-    if (should_send_report) {
-      hid_send_keys(0, keycodes, keycodes_length);
+    for (int i = 0; i < KEYS_COUNT; i++) {
+      if ((pressed_keys ^ previously_pressed_keys) & (1 << i)) {
+        uint32_t event_at = pressed_keys & (1 << i) ? keys[i].triggered_at : keys[i].released_at;
+        if (!has_pending_event || (int32_t)(event_at - pending_event_at) < 0) {
+          pending_event_at = event_at;
+        }
+        has_pending_event = true;
+      }
+    }
+
+    if (should_send_report && hid_send_keys(0, keycodes, keycodes_length) == ESP_OK) {
+      link_sync_on_report_sent(esp_timer_get_time(), has_pending_event, pending_event_at);
+      has_pending_event = false;
     }
 
     if (keycodes_length > 0) {
@@ -194,6 +404,11 @@ void update_keys(void *pvParameters) {
 }
 
 void app_main(void) {
+#if BENCHMARK_KEY_ENGINE
+  benchmark_key_engine();
+  return;
+#endif
+
   // Initialize HID first
   esp_err_t ret = hid_init();
   if (ret != ESP_OK) {
@@ -201,8 +416,15 @@ void app_main(void) {
     return;
   }
 
+  board_init();
+  power_init();
   adc_init();
   init_keys();
+  crosstalk_init();
+  drift_init();
+  keymap_init();
+  vendor_init();
+  battery_init();
 
   xTaskCreate(adc_task, "adc_task", 4096, NULL, 10, NULL);
   xTaskCreate(update_keys, "update_keys", 2048, NULL, 10, NULL);
@@ -1,19 +1,40 @@
 #pragma once
 
+#include "board.h"
 #include <stdint.h>
 
-#define ADC_CHANNEL_COUNT 5
+// Full scale of key samples in mV, calibrated conversions are clamped to it
+#define ADC_VREF 3300
+#define MAX_DISTANCE_PRE_CALIBRATION 500
+
+// Set to 1 to feed the key engine an alpha-beta tracker estimate instead of the sample itself
+#define KEY_TRACKER_ENABLED 0
+// Tracker gains in 1 / (1 << KEY_TRACKER_GAIN_SHIFT). A lower alpha smooths more and lags more,
+// beta = alpha^2 / (2 - alpha) is the steady-state Kalman choice for a given alpha
+#define KEY_TRACKER_GAIN_SHIFT 8
+#define KEY_TRACKER_ALPHA 128
+#define KEY_TRACKER_BETA 43
+// Tracker state resolution, 1 / (1 << shift) mV
+#define KEY_TRACKER_SHIFT 8
+// Tracked velocity, in tracker units per sample, under which the key keeps its direction
+#define KEY_TRACKER_DIRECTION_DEADBAND (2 << KEY_TRACKER_SHIFT)
+
+// Set to 1 to run the key engine benchmark at boot instead of the firmware
+#define BENCHMARK_KEY_ENGINE 0
+#define BENCHMARK_MAX_KEYS 64
+
+// Room in the hot key arrays, larger than the board only for benchmark builds
+#if BENCHMARK_KEY_ENGINE
+#define KEYS_CAPACITY BENCHMARK_MAX_KEYS
+#else
+#define KEYS_CAPACITY KEYS_COUNT
+#endif
 
 struct switch_magnetic_profile {
   uint8_t id;
   uint16_t adc_reading_by_distance[255];
 };
 
-enum magnet_polarity {
-  NORTH_POLE_FACING_DOWN,
-  SOUTH_POLE_FACING_DOWN,
-};
-
 struct deadzones {
   uint8_t start_offset;
   uint8_t end_offset;
@@ -27,6 +48,7 @@ struct rapid_trigger {
 };
 
 struct hardware {
+  uint8_t adc_unit;
   uint8_t adc_channel;
   enum magnet_polarity magnet_polarity;
 };
@@ -38,13 +60,6 @@ struct key_config {
   uint8_t actuation_distance;
   uint8_t release_distance;
   struct rapid_trigger rapid_trigger;
-
-  uint16_t keycode;
-};
-
-struct key_calibration {
-  uint16_t idle_value;
-  uint16_t max_distance;
 };
 
 enum key_direction {
@@ -52,35 +67,71 @@ enum key_direction {
   DOWN,
 };
 
-struct key_state {
-  // uint16_t raw_adc_value;
-  // uint16_t distance;
-  uint8_t distance;
-  // int8_t velocity;
-  // int8_t acceleration;
-  // int8_t jerk;
-};
-
 enum key_status {
   STATUS_RESET,
   STATUS_RAPID_TRIGGER_RESET,
   STATUS_TRIGGERED,
 };
 
-struct key {
-  struct key_config config;
-  struct key_calibration calibration;
-  struct key_state state;
+// Per-sample key state, one contiguous array per field so a scan frame is
+// processed in a single pass over all keys
+struct keys_state {
+  uint16_t normalized_value[KEYS_CAPACITY];
+  uint16_t idle_value[KEYS_CAPACITY];
+  uint16_t max_distance[KEYS_CAPACITY];
+  // (255 << 16) / max_distance, refreshed whenever max_distance grows
+  uint32_t scale[KEYS_CAPACITY];
+  uint8_t start_offset[KEYS_CAPACITY];
+  uint8_t end_offset[KEYS_CAPACITY];
+  uint8_t is_inverted[KEYS_CAPACITY];
+  uint8_t is_tracked[KEYS_CAPACITY];
+  uint8_t actuation_distance[KEYS_CAPACITY];
+  uint8_t release_distance[KEYS_CAPACITY];
+  // Alpha-beta tracker estimates of the normalized value, in tracker units and tracker units per sample
+  int32_t tracked_position[KEYS_CAPACITY];
+  int32_t tracked_velocity[KEYS_CAPACITY];
+
+  uint8_t distance[KEYS_CAPACITY];
+  uint8_t is_idle[KEYS_CAPACITY];
+  uint8_t status[KEYS_CAPACITY];
+  // Time of the sample behind distance, then of the last actuation and release threshold crossings,
+  // interpolated between the two samples around them; esp_timer microseconds truncated to 32 bits
+  uint32_t sampled_at[KEYS_CAPACITY];
+  uint32_t actuated_at[KEYS_CAPACITY];
+  uint32_t released_at[KEYS_CAPACITY];
+};
 
-  uint8_t is_idle;
+// Bookkeeping that the per-sample path never touches, configuration lives in config.h
+struct key {
   enum key_direction direction;
   // Distance from where the travel has begun
   uint8_t from;
   // Time since the travel has begun
   uint32_t since;
-  enum key_status status;
+  // Interpolated crossing times of the last press, in the keys_state time base
   uint32_t triggered_at;
+  uint32_t released_at;
+  uint32_t press_count;
 };
 
+extern struct keys_state keys_state;
+extern struct key keys[KEYS_COUNT];
+
+void init_keys_state(struct keys_state *state, const struct key_config *configs, int count);
+// Refresh the configuration-derived fields without losing calibration
+void apply_keys_config(struct keys_state *state, const struct key_config *configs, int count);
+void update_keys_state(struct keys_state *state, const uint16_t *raw_values, const uint32_t *sampled_at, int count,
+                       uint8_t is_calibrating);
+// Move the calibration bounds of a key, from the scan task between two frames
+void set_key_calibration(struct keys_state *state, int i, uint16_t idle_value, uint16_t max_distance);
+
+/**
+ * @brief Feed one scan frame of raw key samples, indexed by key, to the key engine
+ * @param sampled_at Time each sample was taken, esp_timer microseconds truncated to 32 bits
+ * @param sampled_keys Bitmask of the keys sampled in this frame, the others are left as they are
+ */
+void process_key_frame(const uint16_t raw_values[KEYS_COUNT], const uint32_t sampled_at[KEYS_COUNT],
+                       uint32_t sampled_keys);
+
 // Switch profile lookup table
 // extern const uint8_t switch_profile[3301];
\ No newline at end of file
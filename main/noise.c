@@ -0,0 +1,131 @@
+#include "noise.h"
+#include "esp_log.h"
+
+static const char *TAG = "NOISE";
+
+#define NOISE_SHIFT 8
+// Larger deviations are movement, not noise, and are clipped so squares fit in 32 bits
+#define NOISE_MAX_DEVIATION_MV 127
+
+// Running mean and variance of one resting state, in 1 / (1 << NOISE_SHIFT) mV and mV^2
+struct noise_estimate {
+  int32_t mean;
+  int32_t variance;
+  uint16_t samples;
+};
+
+static struct noise_estimate idle_estimates[KEYS_COUNT] = { 0 };
+static struct noise_estimate bottom_estimates[KEYS_COUNT] = { 0 };
+static struct key_noise key_noises[KEYS_COUNT] = { 0 };
+static uint32_t frames_since_refresh = 0;
+
+static void update_estimate(struct noise_estimate *estimate, int32_t value) {
+  value <<= NOISE_SHIFT;
+  if (estimate->samples == 0) {
+    estimate->mean = value;
+  }
+
+  int32_t delta = value - estimate->mean;
+  if (delta > NOISE_MAX_DEVIATION_MV << NOISE_SHIFT) {
+    delta = NOISE_MAX_DEVIATION_MV << NOISE_SHIFT;
+  } else if (delta < -(NOISE_MAX_DEVIATION_MV << NOISE_SHIFT)) {
+    delta = -(NOISE_MAX_DEVIATION_MV << NOISE_SHIFT);
+  }
+
+  estimate->mean += delta >> NOISE_FILTER_SHIFT;
+  int32_t half_delta = delta >> (NOISE_SHIFT / 2);
+  estimate->variance += (half_delta * half_delta - estimate->variance) >> NOISE_FILTER_SHIFT;
+  if (estimate->samples < NOISE_MIN_SAMPLES) {
+    estimate->samples++;
+  }
+}
+
+static uint32_t isqrt(uint32_t value) {
+  uint32_t root = 0;
+  for (uint32_t bit = 1 << 30; bit != 0; bit >>= 2) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+  }
+  return root;
+}
+
+// Standard deviation in 1/16 mV
+static uint16_t get_sigma(const struct noise_estimate *estimate) {
+  return isqrt(estimate->variance > 0 ? estimate->variance : 0);
+}
+
+// Mean resting offset plus the noise margin, rounded up and bounded
+static uint8_t get_deadzone(const struct noise_estimate *estimate, uint16_t sigma) {
+  int32_t mean = estimate->mean > 0 ? estimate->mean >> (NOISE_SHIFT / 2) : 0;
+  int32_t deadzone = (mean + NOISE_DEADZONE_SIGMAS * sigma + 15) >> (NOISE_SHIFT / 2);
+  if (deadzone < NOISE_DEADZONE_MIN) {
+    return NOISE_DEADZONE_MIN;
+  }
+  return deadzone > NOISE_DEADZONE_MAX ? NOISE_DEADZONE_MAX : deadzone;
+}
+
+static void refresh_deadzones(struct keys_state *state, int count) {
+  for (int i = 0; i < count; i++) {
+    struct key_noise *key_noise = &key_noises[i];
+    key_noise->idle_sigma = get_sigma(&idle_estimates[i]);
+    key_noise->bottom_sigma = get_sigma(&bottom_estimates[i]);
+
+    uint8_t start_offset = idle_estimates[i].samples >= NOISE_MIN_SAMPLES
+                               ? get_deadzone(&idle_estimates[i], key_noise->idle_sigma)
+                               : 0;
+    uint8_t end_offset = bottom_estimates[i].samples >= NOISE_MIN_SAMPLES
+                             ? get_deadzone(&bottom_estimates[i], key_noise->bottom_sigma)
+                             : 0;
+    if ((start_offset != 0 && start_offset != key_noise->start_offset) ||
+        (end_offset != 0 && end_offset != key_noise->end_offset)) {
+      ESP_LOGD(TAG, "key %d: deadzones %d/%d mV, noise %d/%d in 1/16 mV", i, start_offset, end_offset,
+               key_noise->idle_sigma, key_noise->bottom_sigma);
+    }
+    key_noise->start_offset = start_offset;
+    key_noise->end_offset = end_offset;
+  }
+  noise_apply_deadzones(state, count);
+}
+
+void noise_update(struct keys_state *state, int count, uint32_t sampled_keys) {
+  for (int i = 0; i < count; i++) {
+    if (!(sampled_keys & (1 << i))) {
+      continue;
+    }
+    int32_t distance = (int32_t)state->normalized_value[i] - state->idle_value[i];
+    if (state->is_idle[i]) {
+      update_estimate(&idle_estimates[i], distance);
+    } else if (state->distance[i] == 255) {
+      update_estimate(&bottom_estimates[i], (int32_t)state->max_distance[i] - distance);
+    }
+  }
+
+  if (++frames_since_refresh >= NOISE_REFRESH_FRAMES) {
+    refresh_deadzones(state, count);
+    frames_since_refresh = 0;
+  }
+}
+
+void noise_apply_deadzones(struct keys_state *state, int count) {
+  for (int i = 0; i < count; i++) {
+#if NOISE_AUTO_DEADZONES
+    if (key_noises[i].start_offset != 0) {
+      state->start_offset[i] = key_noises[i].start_offset;
+    }
+    if (key_noises[i].end_offset != 0) {
+      state->end_offset[i] = key_noises[i].end_offset;
+    }
+#endif
+  }
+}
+
+void noise_get_key_noise(uint8_t key_index, struct key_noise *key_noise) {
+  *key_noise = key_noises[key_index];
+  // Report the deadzones the key engine actually uses
+  key_noise->start_offset = keys_state.start_offset[key_index];
+  key_noise->end_offset = keys_state.end_offset[key_index];
+}
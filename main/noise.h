@@ -0,0 +1,41 @@
+#pragma once
+
+#include "main.h"
+#include <stdint.h>
+
+// Set to 0 to keep the configured deadzones; ignored with STATIC_KEY_CONFIG
+#define NOISE_AUTO_DEADZONES 1
+// Bounds of the derived deadzones, in mV of travel
+#define NOISE_DEADZONE_MIN 4
+#define NOISE_DEADZONE_MAX 40
+// Margin kept above the mean resting offset, in standard deviations of the noise
+#define NOISE_DEADZONE_SIGMAS 4
+// Weight of each new sample in the noise statistics, 1 / (1 << shift)
+#define NOISE_FILTER_SHIFT 6
+// Samples of a state before its deadzone is derived from it, the configured one is used until then
+#define NOISE_MIN_SAMPLES 512
+// Frames between two deadzone refreshes
+#define NOISE_REFRESH_FRAMES 500
+
+struct key_noise {
+  // Standard deviation at rest and bottomed out, in 1/16 mV
+  uint16_t idle_sigma;
+  uint16_t bottom_sigma;
+  // Deadzones in use, derived or configured
+  uint8_t start_offset;
+  uint8_t end_offset;
+};
+
+/**
+ * @brief Feed the key states of a processed frame, called by the scan task;
+ *        refreshes the deadzones every NOISE_REFRESH_FRAMES frames
+ * @param sampled_keys Bitmask of the keys sampled in this frame, only those are measured
+ */
+void noise_update(struct keys_state *state, int count, uint32_t sampled_keys);
+
+/**
+ * @brief Put derived deadzones back over freshly applied configured ones
+ */
+void noise_apply_deadzones(struct keys_state *state, int count);
+
+void noise_get_key_noise(uint8_t key_index, struct key_noise *key_noise);
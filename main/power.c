@@ -0,0 +1,139 @@
+#include "power.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "hid.h"
+#include "main.h"
+#include "sdkconfig.h"
+#include <inttypes.h>
+
+static const char *TAG = "POWER";
+
+static enum power_state state = POWER_STATE_ACTIVE;
+static int64_t state_entered_at = 0;
+static int64_t last_travel_at = 0;
+static struct power_stats stats = { 0 };
+
+// Raw ADC level at which a key leaves its start deadzone, derived from its calibration
+struct wake_threshold {
+  uint16_t raw_value;
+  // Inverted keys read lower as they travel
+  uint8_t is_below;
+};
+
+static struct wake_threshold wake_thresholds[KEYS_COUNT] = { 0 };
+static uint32_t watched_frames = 0;
+// A wake threshold was crossed, the frame wakes the pad even if its filtered samples show no travel yet
+static bool is_wake_pending = false;
+
+static const char *state_names[POWER_STATES_COUNT] = {
+  [POWER_STATE_ACTIVE] = "active",
+  [POWER_STATE_IDLE] = "idle",
+};
+
+// Automatic light sleep only kicks in while the scan task waits between slow scans
+static void configure_light_sleep(bool is_enabled) {
+  esp_pm_config_t pm_config = {
+    .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+    .min_freq_mhz = CONFIG_XTAL_FREQ,
+    .light_sleep_enable = is_enabled,
+  };
+  esp_err_t ret = esp_pm_configure(&pm_config);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "failed to configure light sleep: %s", esp_err_to_name(ret));
+  }
+}
+
+// Hand the current calibration over to the watch so it matches what the key pipeline would decide
+static void update_wake_thresholds() {
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    uint16_t normalized_value = keys_state.idle_value[i] + keys_state.start_offset[i];
+    if (normalized_value > ADC_VREF) {
+      normalized_value = ADC_VREF;
+    }
+    wake_thresholds[i].is_below = keys_state.is_inverted[i];
+    wake_thresholds[i].raw_value = keys_state.is_inverted[i] ? ADC_VREF - normalized_value : normalized_value;
+  }
+  watched_frames = 0;
+}
+
+static void enter_state(enum power_state new_state, int64_t now) {
+  stats.time_in_state_us[state] += now - state_entered_at;
+  state = new_state;
+  state_entered_at = now;
+
+  if (new_state == POWER_STATE_IDLE) {
+    stats.idle_entries++;
+    update_wake_thresholds();
+  }
+  configure_light_sleep(new_state == POWER_STATE_IDLE);
+  hid_set_low_power(new_state == POWER_STATE_IDLE);
+
+  ESP_LOGI(TAG, "%s, %" PRIu64 " ms active and %" PRIu64 " ms idle so far", state_names[new_state],
+           stats.time_in_state_us[POWER_STATE_ACTIVE] / 1000, stats.time_in_state_us[POWER_STATE_IDLE] / 1000);
+}
+
+void power_init() {
+  state = POWER_STATE_ACTIVE;
+  state_entered_at = esp_timer_get_time();
+  last_travel_at = state_entered_at;
+  configure_light_sleep(false);
+}
+
+void power_update(bool has_travel, int64_t now) {
+  has_travel |= is_wake_pending;
+  is_wake_pending = false;
+  if (has_travel) {
+    last_travel_at = now;
+  }
+
+  switch (state) {
+  case POWER_STATE_ACTIVE:
+    if (now - last_travel_at >= (int64_t)POWER_IDLE_TIMEOUT_MS * 1000) {
+      enter_state(POWER_STATE_IDLE, now);
+    }
+    break;
+  case POWER_STATE_IDLE:
+    if (has_travel) {
+      enter_state(POWER_STATE_ACTIVE, now);
+    } else {
+      update_wake_thresholds();
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+bool power_watch_frame(const uint16_t raw_values[KEYS_COUNT]) {
+  if (state != POWER_STATE_IDLE) {
+    return true;
+  }
+
+  // Let the pipeline follow slow idle drift from time to time
+  if (++watched_frames >= POWER_IDLE_REFRESH_FRAMES) {
+    return true;
+  }
+
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    if (wake_thresholds[i].is_below ? raw_values[i] < wake_thresholds[i].raw_value
+                                    : raw_values[i] > wake_thresholds[i].raw_value) {
+      is_wake_pending = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+TickType_t power_get_scan_delay() {
+  return state == POWER_STATE_IDLE ? pdMS_TO_TICKS(POWER_IDLE_SCAN_PERIOD_MS) : 1;
+}
+
+enum power_state power_get_state() {
+  return state;
+}
+
+void power_get_stats(struct power_stats *power_stats) {
+  *power_stats = stats;
+  power_stats->time_in_state_us[state] += esp_timer_get_time() - state_entered_at;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "board.h"
+#include "freertos/FreeRTOS.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Time without any key travel before the pad drops to the idle state
+#define POWER_IDLE_TIMEOUT_MS (30 * 1000)
+// Scan period while idle, also the worst-case wake-up latency
+#define POWER_IDLE_SCAN_PERIOD_MS 100
+// Idle frames only compared against wake thresholds before one goes through the full key pipeline
+#define POWER_IDLE_REFRESH_FRAMES 50
+
+enum power_state {
+  POWER_STATE_ACTIVE,
+  POWER_STATE_IDLE,
+  POWER_STATES_COUNT,
+};
+
+struct power_stats {
+  // Cumulated time spent in each state since boot, including the current one
+  uint64_t time_in_state_us[POWER_STATES_COUNT];
+  uint32_t idle_entries;
+};
+
+void power_init(void);
+
+/**
+ * @brief Feed the activity of the latest scan frame, called by the scan task
+ * @param has_travel True when at least one key is out of its start deadzone
+ */
+void power_update(bool has_travel, int64_t now);
+
+/**
+ * @brief Compare raw samples against the wake thresholds handed over on idle entry
+ * @return True when the frame must go through the key pipeline: always while active,
+ *         when a key leaves its start deadzone or when the calibration is due a refresh
+ */
+bool power_watch_frame(const uint16_t raw_values[KEYS_COUNT]);
+
+/**
+ * @brief Delay to wait before starting the next scan in the current state
+ */
+TickType_t power_get_scan_delay(void);
+
+enum power_state power_get_state(void);
+void power_get_stats(struct power_stats *stats);
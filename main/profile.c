@@ -0,0 +1,235 @@
+#include "profile.h"
+#include "config.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+
+static const char *TAG = "PROFILE";
+
+#define PROFILE_NAMESPACE "profiles"
+#define PROFILE_ACTIVE_KEY "active"
+#define PROFILE_MAGIC 0x4C505246 // "LPRF"
+// Bump whenever struct profile_blob changes, older blobs are then ignored
+#define PROFILE_FORMAT_VERSION 1
+
+// Stored tuning of one key, the board hardware is never part of a profile
+struct __attribute__((packed)) profile_key {
+  uint8_t start_offset;
+  uint8_t end_offset;
+  uint8_t actuation_distance;
+  uint8_t release_distance;
+  uint8_t rapid_trigger_is_enabled;
+  uint8_t rapid_trigger_is_continuous;
+  uint8_t rapid_trigger_actuation_distance_delta;
+  uint8_t rapid_trigger_release_distance_delta;
+};
+
+// On-flash layout of a profile, read and written as a single NVS blob
+struct __attribute__((packed)) profile_blob {
+  uint32_t magic;
+  uint16_t format_version;
+  uint8_t keys_count;
+  uint8_t layers_count;
+  char name[PROFILE_NAME_LENGTH];
+  struct profile_key keys[KEYS_COUNT];
+  uint16_t keymap[LAYERS_COUNT][KEYS_COUNT];
+  // CRC-32 of every field above
+  uint32_t crc;
+};
+
+// Written by whichever task selects a profile, under the config edit lock
+static _Atomic uint8_t active_profile = 0;
+static TaskHandle_t profile_task_handle = NULL;
+
+static uint32_t profile_crc(const struct profile_blob *profile) {
+  return esp_rom_crc32_le(0, (const uint8_t *)profile, offsetof(struct profile_blob, crc));
+}
+
+static void profile_key_name(uint8_t index, char key_name[4]) {
+  key_name[0] = 'p';
+  key_name[1] = '0' + index;
+  key_name[2] = '\0';
+}
+
+static void serialize(const struct keys_config *config, const char *name, struct profile_blob *profile) {
+  memset(profile, 0, sizeof(struct profile_blob));
+  profile->magic = PROFILE_MAGIC;
+  profile->format_version = PROFILE_FORMAT_VERSION;
+  profile->keys_count = KEYS_COUNT;
+  profile->layers_count = LAYERS_COUNT;
+  strncpy(profile->name, name, PROFILE_NAME_LENGTH - 1);
+
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    profile->keys[i].start_offset = config->keys[i].deadzones.start_offset;
+    profile->keys[i].end_offset = config->keys[i].deadzones.end_offset;
+    profile->keys[i].actuation_distance = config->keys[i].actuation_distance;
+    profile->keys[i].release_distance = config->keys[i].release_distance;
+    profile->keys[i].rapid_trigger_is_enabled = config->keys[i].rapid_trigger.is_enabled;
+    profile->keys[i].rapid_trigger_is_continuous = config->keys[i].rapid_trigger.is_continuous;
+    profile->keys[i].rapid_trigger_actuation_distance_delta = config->keys[i].rapid_trigger.actuation_distance_delta;
+    profile->keys[i].rapid_trigger_release_distance_delta = config->keys[i].rapid_trigger.release_distance_delta;
+  }
+  memcpy(profile->keymap, config->keymap, sizeof(profile->keymap));
+
+  profile->crc = profile_crc(profile);
+}
+
+static void deserialize(const struct profile_blob *profile, struct keys_config *config) {
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    config->keys[i].deadzones.start_offset = profile->keys[i].start_offset;
+    config->keys[i].deadzones.end_offset = profile->keys[i].end_offset;
+    config->keys[i].actuation_distance = profile->keys[i].actuation_distance;
+    config->keys[i].release_distance = profile->keys[i].release_distance;
+    config->keys[i].rapid_trigger.is_enabled = profile->keys[i].rapid_trigger_is_enabled;
+    config->keys[i].rapid_trigger.is_continuous = profile->keys[i].rapid_trigger_is_continuous;
+    config->keys[i].rapid_trigger.actuation_distance_delta = profile->keys[i].rapid_trigger_actuation_distance_delta;
+    config->keys[i].rapid_trigger.release_distance_delta = profile->keys[i].rapid_trigger_release_distance_delta;
+  }
+  memcpy(config->keymap, profile->keymap, sizeof(config->keymap));
+}
+
+// Read a profile with a single blob lookup and check it belongs to this firmware and board
+static esp_err_t read_profile(nvs_handle_t handle, uint8_t index, struct profile_blob *profile) {
+  char key_name[4];
+  profile_key_name(index, key_name);
+
+  size_t length = sizeof(struct profile_blob);
+  esp_err_t ret = nvs_get_blob(handle, key_name, profile, &length);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  if (length != sizeof(struct profile_blob) || profile->magic != PROFILE_MAGIC ||
+      profile->format_version != PROFILE_FORMAT_VERSION || profile->keys_count != KEYS_COUNT ||
+      profile->layers_count != LAYERS_COUNT) {
+    ESP_LOGW(TAG, "profile %d has an incompatible layout", index);
+    return ESP_ERR_INVALID_VERSION;
+  }
+
+  if (profile->crc != profile_crc(profile)) {
+    ESP_LOGW(TAG, "profile %d is corrupted", index);
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t profile_select(uint8_t index) {
+  if (index >= PROFILES_COUNT) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  nvs_handle_t handle;
+  esp_err_t ret = nvs_open(PROFILE_NAMESPACE, NVS_READWRITE, &handle);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "failed to open NVS: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  // Each caller reads into its own blob, a save running meanwhile never writes this one
+  struct profile_blob blob;
+  struct keys_config *config = config_begin_edit();
+  if (config == NULL) {
+    nvs_close(handle);
+    return ESP_ERR_TIMEOUT;
+  }
+
+  ret = read_profile(handle, index, &blob);
+  if (ret == ESP_OK) {
+    deserialize(&blob, config);
+    if (!config_is_valid(config)) {
+      ESP_LOGW(TAG, "profile %d has invalid thresholds or actions", index);
+      ret = ESP_ERR_INVALID_ARG;
+    }
+  }
+  if (ret == ESP_OK) {
+    ESP_LOGI(TAG, "profile %d \"%.*s\" loaded", index, PROFILE_NAME_LENGTH, blob.name);
+  } else {
+    // Empty or invalid slots start from the build-time defaults
+    config_load_defaults(config);
+    ESP_LOGI(TAG, "profile %d not stored, using defaults", index);
+  }
+
+  // Still under the edit lock, so the stored selection always matches the published configuration.
+  // Only write the selection when it changes, boot stays read-only
+  if (index != atomic_load(&active_profile) && nvs_set_u8(handle, PROFILE_ACTIVE_KEY, index) == ESP_OK) {
+    nvs_commit(handle);
+  }
+  atomic_store(&active_profile, index);
+  config_publish();
+  nvs_close(handle);
+
+  return ESP_OK;
+}
+
+esp_err_t profile_save(uint8_t index, const char *name) {
+  if (index >= PROFILES_COUNT) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  nvs_handle_t handle;
+  esp_err_t ret = nvs_open(PROFILE_NAMESPACE, NVS_READWRITE, &handle);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "failed to open NVS: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  struct keys_config config;
+  struct profile_blob blob;
+  config_snapshot(&config);
+  serialize(&config, name, &blob);
+
+  char key_name[4];
+  profile_key_name(index, key_name);
+
+  ret = nvs_set_blob(handle, key_name, &blob, sizeof(blob));
+  if (ret == ESP_OK) {
+    ret = nvs_commit(handle);
+  }
+  nvs_close(handle);
+
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "failed to save profile %d: %s", index, esp_err_to_name(ret));
+  }
+  return ret;
+}
+
+static void profile_task(void *pvParameters) {
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    profile_select((atomic_load(&active_profile) + 1) % PROFILES_COUNT);
+  }
+}
+
+void profile_request_next() {
+  if (profile_task_handle != NULL) {
+    xTaskNotifyGive(profile_task_handle);
+  }
+}
+
+void profile_init() {
+  nvs_handle_t handle;
+  uint8_t index = 0;
+
+  if (nvs_open(PROFILE_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+    if (nvs_get_u8(handle, PROFILE_ACTIVE_KEY, &index) != ESP_OK || index >= PROFILES_COUNT) {
+      index = 0;
+    }
+    nvs_close(handle);
+  }
+
+  atomic_store(&active_profile, index);
+  profile_select(index);
+
+  // NVS access stays off the scan and key tasks
+  xTaskCreate(profile_task, "profile_task", 3072, NULL, 5, &profile_task_handle);
+}
+
+uint8_t profile_get_active() {
+  return atomic_load(&active_profile);
+}
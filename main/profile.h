@@ -0,0 +1,31 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+
+#define PROFILES_COUNT 4
+#define PROFILE_NAME_LENGTH 16
+
+/**
+ * @brief Load the last selected profile into the active configuration
+ * @note NVS must be initialized, each profile is a single blob read
+ */
+void profile_init(void);
+
+/**
+ * @brief Load a stored profile and publish it as the active configuration
+ * @param index Profile slot, build-time defaults are used when the slot is empty or invalid
+ */
+esp_err_t profile_select(uint8_t index);
+
+/**
+ * @brief Store the active configuration in a profile slot
+ */
+esp_err_t profile_save(uint8_t index, const char *name);
+
+/**
+ * @brief Switch to the next profile from a task other than the key tasks
+ */
+void profile_request_next(void);
+
+uint8_t profile_get_active(void);
@@ -1,24 +1,189 @@
 #include "sensor.h"
-#include "esp_hidd_prf_api.h"
+#include "config.h"
+#include "crosstalk.h"
+#include "driver/gpio.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
 #include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "hid.h"
+#include "link_sync.h"
 #include "main.h"
+#include "power.h"
 #include "sdkconfig.h"
 #include <string.h>
 
 static const char *TAG = "SENSOR";
 
-#define CONVERSION_FRAME_SIZE (SOC_ADC_DIGI_DATA_BYTES_PER_CONV * ADC_CHANNEL_COUNT)
-#define CONVERSION_POOL_SIZE CONVERSION_FRAME_SIZE * 1
+#if SENSOR_OVERSAMPLING < 1 || SENSOR_OVERSAMPLING > 16
+#error "SENSOR_OVERSAMPLING must be between 1 and 16"
+#endif
 
-extern const uint32_t adc_channels[ADC_CHANNEL_COUNT];
+// The pattern runs SENSOR_OVERSAMPLING times per frame, back to back at the same multiplexer address
+#define CONVERSION_FRAME_SIZE (SOC_ADC_DIGI_DATA_BYTES_PER_CONV * ADC_CHANNEL_COUNT * SENSOR_OVERSAMPLING)
+#define CONVERSION_POOL_SIZE CONVERSION_FRAME_SIZE * 1
+#define SCAN_STATS_PERIOD_US (5 * 1000 * 1000)
+#define ADC_RAW_COUNT (1 << SOC_ADC_DIGI_MAX_BITWIDTH)
 
 adc_continuous_handle_t adc_handle;
 static TaskHandle_t adc_task_handle;
 
-extern void update_key_state(adc_channel_t adc_channel, uint16_t raw_value);
+struct scan_window {
+  uint32_t samples;
+  int64_t last_sample_at;
+  uint32_t min_interval;
+  uint32_t max_interval;
+};
+
+static struct scan_window scan_windows[KEYS_COUNT] = { 0 };
+static struct scan_stats scan_stats[KEYS_COUNT] = { 0 };
+static int64_t scan_window_started_at = 0;
+
+// Latest sample of every key in mV; multiplexed keys keep their value until their address comes around again
+static uint16_t key_samples[KEYS_COUNT] = { 0 };
+// Crosstalk-corrected copy of key_samples fed to the key engine, rebuilt every frame
+static uint16_t corrected_samples[KEYS_COUNT] = { 0 };
+#if SENSOR_SPIKE_FILTER
+// Latest samples before the spike filter, checked against the wake thresholds while idle
+static uint16_t unfiltered_samples[KEYS_COUNT] = { 0 };
+#endif
+// Middle of the conversions behind each sample, esp_timer microseconds truncated to 32 bits
+static uint32_t key_sampled_at[KEYS_COUNT] = { 0 };
+
+// Boxcar decimator, sums the conversions of each key over one frame
+static uint32_t key_sums[KEYS_COUNT] = { 0 };
+static uint8_t key_counts[KEYS_COUNT] = { 0 };
+
+// Three-tap median per key: a sample only comes out once the next one confirms it, so a lone glitch
+// never reaches the calibration or the triggers
+struct spike_filter {
+  uint16_t previous;
+  uint16_t current;
+  uint32_t current_at;
+  uint8_t is_primed;
+};
+
+static struct spike_filter spike_filters[KEYS_COUNT] = { 0 };
+static uint32_t rejected_samples[KEYS_COUNT] = { 0 };
+
+// Calibrated mV of every raw code, one table per sampled channel, built once so a conversion costs a single load
+static uint16_t mv_by_raw[ADC_CHANNEL_COUNT][ADC_RAW_COUNT];
+// Table of each conversion result's unit/channel, indexed like board_inputs_by_channel
+static const uint16_t *mv_tables_by_channel[BOARD_ADC_UNIT_SLOTS][BOARD_ADC_CHANNEL_SLOTS] = { 0 };
+
+// Written by the battery task, read once per frame; a single word so it is never torn
+static volatile uint32_t supply_gain = SENSOR_SUPPLY_GAIN_ONE;
+
+#define MUX_SELECT_PIN_MASK(gpio) | (1ULL << (gpio))
+#define MUX_SELECT_SET_LEVEL(gpio) gpio_set_level(gpio, (address >> MUX_SELECT_GPIO_##gpio) & 1);
+
+static void mux_init() {
+  if (MUX_SELECT_BITS == 0) {
+    return;
+  }
+
+  gpio_config_t select_config = {
+    .pin_bit_mask = 0 BOARD_MUX_SELECT_GPIOS(MUX_SELECT_PIN_MASK),
+    .mode = GPIO_MODE_OUTPUT,
+  };
+  ESP_ERROR_CHECK(gpio_config(&select_config));
+}
+
+static void mux_select(uint8_t address) {
+  BOARD_MUX_SELECT_GPIOS(MUX_SELECT_SET_LEVEL)
+}
+
+static void record_sample(uint8_t key_index, int64_t sampled_at) {
+  struct scan_window *window = &scan_windows[key_index];
+
+  if (window->last_sample_at != 0) {
+    uint32_t interval = sampled_at - window->last_sample_at;
+    if (window->samples == 0 || interval < window->min_interval) {
+      window->min_interval = interval;
+    }
+    if (interval > window->max_interval) {
+      window->max_interval = interval;
+    }
+    window->samples++;
+  }
+  window->last_sample_at = sampled_at;
+}
+
+static void publish_scan_stats(int64_t now) {
+  int64_t elapsed = now - scan_window_started_at;
+  uint32_t min_rate = UINT32_MAX;
+  uint32_t max_jitter = 0;
+
+  for (int i = 0; i < KEYS_COUNT; i++) {
+    scan_stats[i].rate_hz = (uint64_t)scan_windows[i].samples * 1000000 / elapsed;
+    scan_stats[i].jitter_us = scan_windows[i].max_interval - scan_windows[i].min_interval;
+    ESP_LOGD(TAG, "key %d: %" PRIu32 " Hz, interval %" PRIu32 "-%" PRIu32 " us", i,
+             scan_stats[i].rate_hz, scan_windows[i].min_interval, scan_windows[i].max_interval);
+
+    if (scan_stats[i].rate_hz < min_rate) {
+      min_rate = scan_stats[i].rate_hz;
+    }
+    if (scan_stats[i].jitter_us > max_jitter) {
+      max_jitter = scan_stats[i].jitter_us;
+    }
+
+    scan_windows[i].samples = 0;
+    scan_windows[i].min_interval = 0;
+    scan_windows[i].max_interval = 0;
+  }
+
+  ESP_LOGI(TAG, "scan rate >= %" PRIu32 " Hz per key, jitter <= %" PRIu32 " us", min_rate, max_jitter);
+  scan_window_started_at = now;
+}
+
+void sensor_get_scan_stats(uint8_t key_index, struct scan_stats *stats) {
+  *stats = scan_stats[key_index];
+  stats->rejected_samples = rejected_samples[key_index];
+}
+
+// The median stands for the middle sample of the window, sampled_at is moved back to its time
+static uint16_t reject_spike(uint8_t key_index, uint16_t sample, uint32_t *sampled_at) {
+  struct spike_filter *filter = &spike_filters[key_index];
+  if (!filter->is_primed) {
+    filter->previous = sample;
+    filter->current = sample;
+    filter->current_at = *sampled_at;
+    filter->is_primed = 1;
+  }
+
+  uint16_t low = filter->previous < filter->current ? filter->previous : filter->current;
+  uint16_t high = filter->previous < filter->current ? filter->current : filter->previous;
+  uint16_t median = sample < low ? low : (sample > high ? high : sample);
+  if (filter->current > median + SENSOR_SPIKE_MIN_MV || median > filter->current + SENSOR_SPIKE_MIN_MV) {
+    rejected_samples[key_index]++;
+  }
+
+  filter->previous = filter->current;
+  filter->current = sample;
+  uint32_t median_at = filter->current_at;
+  filter->current_at = *sampled_at;
+  *sampled_at = median_at;
+  return median;
+}
+
+uint32_t sensor_get_supply_gain(uint16_t supply_mv) {
+  if (supply_mv + SENSOR_SUPPLY_MAX_DEVIATION_MV < BOARD_SENSOR_SUPPLY_NOMINAL_MV ||
+      supply_mv > BOARD_SENSOR_SUPPLY_NOMINAL_MV + SENSOR_SUPPLY_MAX_DEVIATION_MV) {
+    return 0;
+  }
+  return ((uint32_t)BOARD_SENSOR_SUPPLY_NOMINAL_MV << SENSOR_SUPPLY_GAIN_SHIFT) / supply_mv;
+}
+
+void sensor_set_supply_mv(uint16_t supply_mv) {
+  uint32_t gain = sensor_get_supply_gain(supply_mv);
+  if (gain == 0) {
+    ESP_LOGW(TAG, "sensor supply %d mV out of range, compensation unchanged", supply_mv);
+    return;
+  }
+  supply_gain = gain;
+}
 
 static bool IRAM_ATTR
 on_conversion_done_cb(adc_continuous_handle_t handle,
@@ -30,7 +195,50 @@ on_conversion_done_cb(adc_continuous_handle_t handle,
   return (mustYield == pdTRUE);
 }
 
+// The calibration scheme is only used here, samples then go through the tables
+static void build_mv_table(uint16_t *table, const adc_digi_pattern_config_t *pattern) {
+  adc_cali_handle_t cali = NULL;
+  esp_err_t ret = ESP_ERR_NOT_SUPPORTED;
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+  adc_cali_curve_fitting_config_t cali_config = {
+    .unit_id = pattern->unit,
+    .chan = pattern->channel,
+    .atten = pattern->atten,
+    .bitwidth = pattern->bit_width,
+  };
+  ret = adc_cali_create_scheme_curve_fitting(&cali_config, &cali);
+#endif
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "no calibration for ADC unit %d channel %d, using a linear estimate: %s",
+             pattern->unit, pattern->channel, esp_err_to_name(ret));
+  }
+
+  for (int raw = 0; raw < ADC_RAW_COUNT; raw++) {
+    int mv = raw * ADC_VREF / (ADC_RAW_COUNT - 1);
+    if (cali != NULL) {
+      adc_cali_raw_to_voltage(cali, raw, &mv);
+    }
+    table[raw] = mv < ADC_VREF ? mv : ADC_VREF;
+  }
+
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+  if (cali != NULL) {
+    adc_cali_delete_scheme_curve_fitting(cali);
+  }
+#endif
+}
+
+static void build_mv_tables() {
+  for (int i = 0; i < ADC_CHANNEL_COUNT; i++) {
+    build_mv_table(mv_by_raw[i], &board_adc_pattern[i]);
+    mv_tables_by_channel[board_adc_pattern[i].unit][board_adc_pattern[i].channel] = mv_by_raw[i];
+  }
+}
+
 void adc_init() {
+  mux_init();
+  build_mv_tables();
+
   //-------------ADC Init---------------//
   adc_continuous_handle_cfg_t adc_config = {
     .max_store_buf_size = CONVERSION_POOL_SIZE,
@@ -47,17 +255,11 @@ void adc_init() {
     .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
   };
 
-  adc_digi_pattern_config_t adc_pattern[ADC_CHANNEL_COUNT] = { 0 };
   for (int i = 0; i < ADC_CHANNEL_COUNT; i++) {
-    adc_pattern[i].atten = ADC_ATTEN_DB_12;
-    adc_pattern[i].channel = adc_channels[i];
-    adc_pattern[i].unit = ADC_UNIT_1;
-    adc_pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
-
     ESP_LOGI(TAG, "adc_pattern[%d].channel is :%" PRIx8, i,
-             adc_pattern[i].channel);
+             board_adc_pattern[i].channel);
   }
-  config.adc_pattern = adc_pattern;
+  config.adc_pattern = board_adc_pattern;
   ESP_ERROR_CHECK(adc_continuous_config(adc_handle, &config));
 
   adc_continuous_evt_cbs_t callbacks = {
@@ -67,59 +269,127 @@ void adc_init() {
       adc_continuous_register_event_callbacks(adc_handle, &callbacks, NULL));
 }
 
-void update_battery_voltage(uint16_t raw_value) {
-  if (hid_is_connected()) {
-    static uint8_t battery_lev = 0;
-    uint8_t new_battery_lev = 0;
-    uint16_t voltage = raw_value * 2;
-    // Convert voltage to percentage (assuming 3.0V min, 4.2V max for Li-ion)
-    if (voltage >= 4200) {
-      new_battery_lev = 100;
-    } else if (voltage <= 3000) {
-      new_battery_lev = 0;
-    } else {
-      new_battery_lev = ((voltage - 3000) * 100) / (4200 - 3000);
-    }
-
-    if (new_battery_lev != battery_lev) {
-      battery_lev = new_battery_lev;
-      // Send battery level to BLE host if connected
-      esp_hidd_send_battery_level(hid_get_conn_id(), battery_lev);
-    }
-  }
-}
-
 void adc_task(void *pvParameters) {
   adc_task_handle = xTaskGetCurrentTaskHandle();
   uint32_t conversion_frame_real_size = 0;
   uint8_t conversions[CONVERSION_FRAME_SIZE] = { 0 };
   memset(conversions, 0, CONVERSION_FRAME_SIZE);
+  uint8_t mux_address = 0;
+  int64_t mux_switched_at = 0;
+
+  mux_select(mux_address);
+  scan_window_started_at = esp_timer_get_time();
 
   while (1) {
+    // One tick at full rate, longer in the idle state; the ADC is stopped meanwhile so the chip can light sleep
+    vTaskDelay(power_get_scan_delay());
+    int64_t started_at = esp_timer_get_time();
     ESP_ERROR_CHECK(adc_continuous_start(adc_handle));
-    vTaskDelay(1);
     ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
     adc_continuous_read(adc_handle, conversions, CONVERSION_FRAME_SIZE,
                         &conversion_frame_real_size, 0);
 
     ESP_ERROR_CHECK(adc_continuous_stop(adc_handle));
+    int64_t sampled_at = esp_timer_get_time();
+    // Oversampling passes are spread evenly over the frame, their average stands for its middle
+    uint32_t converted_at = started_at + (sampled_at - started_at) / 2;
+#if BOARD_SENSOR_SUPPLY_FROM_BATTERY
+    uint32_t frame_supply_gain = supply_gain;
+#else
+    const uint32_t frame_supply_gain = SENSOR_SUPPLY_GAIN_ONE;
+#endif
 
-    for (uint8_t conversion_result_index = 0;
+    // Switch the multiplexers right away so they settle while this frame is processed
+    uint8_t sampled_mux_address = mux_address;
+    if (MUX_ADDRESS_COUNT > 1) {
+      mux_address = (mux_address + 1) % MUX_ADDRESS_COUNT;
+      mux_select(mux_address);
+      mux_switched_at = sampled_at;
+    }
+
+    for (uint32_t conversion_result_index = 0;
          conversion_result_index < conversion_frame_real_size;
          conversion_result_index += SOC_ADC_DIGI_DATA_BYTES_PER_CONV) {
       adc_digi_output_data_t *conversion_frame =
           (adc_digi_output_data_t *)&conversions[conversion_result_index];
-      for (uint8_t adc_channel = 0; adc_channel < ADC_CHANNEL_COUNT;
-           adc_channel++) {
-        if (conversion_frame->type2.channel == adc_channels[adc_channel]) {
-          if (adc_channels[adc_channel] == ADC_CHANNEL_0) {
-            update_battery_voltage(conversion_frame->type2.data);
-          } else {
-            update_key_state(adc_channel, conversion_frame->type2.data);
-          }
-          break;
-        }
+      const struct board_input *input =
+          &board_inputs_by_channel[sampled_mux_address]
+                                  [conversion_frame->type2.unit]
+                                  [conversion_frame->type2.channel];
+      switch (input->type) {
+      case BOARD_INPUT_KEY: {
+        // Averaged in mV, the calibration curve is not linear in raw codes
+        key_sums[input->index] += mv_tables_by_channel[conversion_frame->type2.unit][conversion_frame->type2.channel]
+                                                      [conversion_frame->type2.data];
+        key_counts[input->index]++;
+        break;
+      }
+      default:
+        break;
+      }
+    }
+
+    // Keys behind other multiplexer addresses got no conversion this frame
+    uint32_t sampled_keys = 0;
+    for (int i = 0; i < KEYS_COUNT; i++) {
+      if (key_counts[i] == 0) {
+        continue;
+      }
+      uint16_t mv = (key_sums[i] + key_counts[i] / 2) / key_counts[i];
+      uint32_t mv_sampled_at = converted_at;
+      mv = sensor_compensate_supply(mv, frame_supply_gain);
+      mv = mv < ADC_VREF ? mv : ADC_VREF;
+#if SENSOR_SPIKE_FILTER
+      unfiltered_samples[i] = mv;
+      mv = reject_spike(i, mv, &mv_sampled_at);
+#endif
+      key_samples[i] = mv;
+      key_sampled_at[i] = mv_sampled_at;
+      record_sample(i, sampled_at);
+      key_sums[i] = 0;
+      key_counts[i] = 0;
+      sampled_keys |= 1 << i;
+    }
+
+    // Corrected from the latest samples of all keys, never in place so a key waiting for its
+    // multiplexer address is not corrected over and over
+    memcpy(corrected_samples, key_samples, sizeof(corrected_samples));
+    crosstalk_correct(corrected_samples, &keys_state);
+
+    // While idle most frames stop at the wake thresholds, the frame crossing one is fully processed.
+    // The thresholds see the samples before the spike filter, its median would hold a press back by
+    // one slow idle frame; the pad wakes on a spike at worst, the key engine still gets the median.
+    // Crosstalk only moves keys next to a pressed one, which crosses its own threshold first
+    const uint16_t *wake_samples = corrected_samples;
+#if SENSOR_SPIKE_FILTER
+    if (power_get_state() == POWER_STATE_IDLE) {
+      wake_samples = unfiltered_samples;
+    }
+#endif
+    if (power_watch_frame(wake_samples)) {
+      process_key_frame(corrected_samples, key_sampled_at, sampled_keys);
+
+      bool has_travel = false;
+      for (int i = 0; i < KEYS_COUNT; i++) {
+        has_travel |= !keys_state.is_idle[i];
+      }
+      power_update(has_travel, sampled_at);
+    } else {
+      // The key engine skips this frame, still report the scan reader's version so edits are not held up
+      config_acquire(CONFIG_READER_SCAN);
+    }
+    link_sync_on_frame(sampled_at);
+
+    if (sampled_at - scan_window_started_at >= SCAN_STATS_PERIOD_US) {
+      publish_scan_stats(sampled_at);
+    }
+
+    // Honour the remaining settle time before the next conversion
+    if (MUX_ADDRESS_COUNT > 1) {
+      int64_t settled_for = esp_timer_get_time() - mux_switched_at;
+      if (settled_for < BOARD_MUX_SETTLE_US) {
+        esp_rom_delay_us(BOARD_MUX_SETTLE_US - settled_for);
       }
     }
   }
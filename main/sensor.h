@@ -3,8 +3,47 @@
 
 #include "esp_adc/adc_continuous.h"
 
+struct scan_stats {
+  // Samples per second delivered to the key over the last report window
+  uint32_t rate_hz;
+  // Spread between the shortest and longest sampling interval over that window
+  uint32_t jitter_us;
+  // Samples replaced by the spike filter since boot
+  uint32_t rejected_samples;
+};
+
+// Conversions averaged into each key sample, 1 to 16; one scan still yields one sample per key
+#define SENSOR_OVERSAMPLING 4
+
+// Set to 0 to feed samples to the key engine unfiltered; the filter delays them by one sample
+#define SENSOR_SPIKE_FILTER 1
+// Corrections of the three-tap median larger than this count as a rejected sample, smaller ones are noise
+#define SENSOR_SPIKE_MIN_MV 20
+
+// Supply compensation gain, in 1 / (1 << shift)
+#define SENSOR_SUPPLY_GAIN_SHIFT 16
+#define SENSOR_SUPPLY_GAIN_ONE (1 << SENSOR_SUPPLY_GAIN_SHIFT)
+// Supply readings further than this from nominal are taken as a bad sample and leave the gain unchanged
+#define SENSOR_SUPPLY_MAX_DEVIATION_MV 1000
+
+// Ratiometric sensors read proportionally to their supply, rescale a sample to the nominal supply
+static inline uint16_t sensor_compensate_supply(uint16_t sample, uint32_t supply_gain) {
+  return ((uint32_t)sample * supply_gain) >> SENSOR_SUPPLY_GAIN_SHIFT;
+}
+
+/**
+ * @brief Gain bringing samples taken at the given supply back to BOARD_SENSOR_SUPPLY_NOMINAL_MV
+ */
+uint32_t sensor_get_supply_gain(uint16_t supply_mv);
+
+/**
+ * @brief Feed the filtered sensor supply, picked up by the scan task on its next frame
+ */
+void sensor_set_supply_mv(uint16_t supply_mv);
+
 void adc_init(void);
 void adc_task(void *pvParameters);
+void sensor_get_scan_stats(uint8_t key_index, struct scan_stats *stats);
 extern adc_continuous_handle_t adc_handle;
 
 #endif // SENSOR_H
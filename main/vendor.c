@@ -0,0 +1,496 @@
+#include "vendor.h"
+#include "battery.h"
+#include "config.h"
+#include "crosstalk.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "hid.h"
+#include "link_sync.h"
+#include "main.h"
+#include "noise.h"
+#include "power.h"
+#include "profile.h"
+#include "sensor.h"
+#include <string.h>
+
+static const char *TAG = "VENDOR";
+
+#define VENDOR_QUEUE_LENGTH 4
+#define VENDOR_HEADER_LENGTH 2
+#define VENDOR_RESPONSE_HEADER_LENGTH 3
+#define VENDOR_RESPONSE_PAYLOAD_LENGTH (HID_VENDOR_REPORT_LENGTH - VENDOR_RESPONSE_HEADER_LENGTH)
+
+struct vendor_request {
+  uint8_t length;
+  uint8_t data[HID_VENDOR_REQUEST_LENGTH];
+};
+
+struct vendor_response {
+  uint8_t length;
+  uint8_t data[HID_VENDOR_REPORT_LENGTH];
+};
+
+static QueueHandle_t request_queue = NULL;
+static uint8_t stream_rate_hz = 0;
+
+static void put_u16(uint8_t *data, uint16_t value) {
+  data[0] = value & 0xFF;
+  data[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *data, uint32_t value) {
+  put_u16(data, value & 0xFFFF);
+  put_u16(data + 2, value >> 16);
+}
+
+static uint16_t get_u16(const uint8_t *data) {
+  return data[0] | (data[1] << 8);
+}
+
+// Runs on the Bluetooth task, the work is deferred to the vendor task
+static void vendor_receive(const uint8_t *data, uint16_t length) {
+  struct vendor_request request = { 0 };
+
+  if (length < VENDOR_HEADER_LENGTH || length > HID_VENDOR_REQUEST_LENGTH) {
+    ESP_LOGW(TAG, "dropped a %d bytes request", length);
+    return;
+  }
+
+  request.length = length;
+  memcpy(request.data, data, length);
+  if (xQueueSend(request_queue, &request, 0) != pdTRUE) {
+    ESP_LOGW(TAG, "request queue full, dropped command 0x%02x", data[1]);
+  }
+}
+
+static int field_value(const struct keys_config *config, uint8_t key, uint8_t field) {
+  const struct key_config *key_config = &config->keys[key];
+
+  switch (field) {
+  case VENDOR_FIELD_START_OFFSET:
+    return key_config->deadzones.start_offset;
+  case VENDOR_FIELD_END_OFFSET:
+    return key_config->deadzones.end_offset;
+  case VENDOR_FIELD_ACTUATION_DISTANCE:
+    return key_config->actuation_distance;
+  case VENDOR_FIELD_RELEASE_DISTANCE:
+    return key_config->release_distance;
+  case VENDOR_FIELD_RAPID_TRIGGER_ENABLED:
+    return key_config->rapid_trigger.is_enabled;
+  case VENDOR_FIELD_RAPID_TRIGGER_CONTINUOUS:
+    return key_config->rapid_trigger.is_continuous;
+  case VENDOR_FIELD_RAPID_TRIGGER_ACTUATION_DELTA:
+    return key_config->rapid_trigger.actuation_distance_delta;
+  case VENDOR_FIELD_RAPID_TRIGGER_RELEASE_DELTA:
+    return key_config->rapid_trigger.release_distance_delta;
+  default:
+    if (field >= VENDOR_FIELD_KEYMAP && field < VENDOR_FIELD_KEYMAP + LAYERS_COUNT) {
+      return config->keymap[field - VENDOR_FIELD_KEYMAP][key];
+    }
+    return -1;
+  }
+}
+
+static bool is_valid_field(uint8_t key, uint8_t field, uint16_t value) {
+  if (key >= KEYS_COUNT) {
+    return false;
+  }
+  if (field >= VENDOR_FIELD_KEYMAP && field < VENDOR_FIELD_KEYMAP + LAYERS_COUNT) {
+    return keymap_is_valid_action(value);
+  }
+  return field <= VENDOR_FIELD_RAPID_TRIGGER_RELEASE_DELTA && value <= UINT8_MAX;
+}
+
+static void set_field(struct keys_config *config, uint8_t key, uint8_t field, uint16_t value) {
+  struct key_config *key_config = &config->keys[key];
+
+  switch (field) {
+  case VENDOR_FIELD_START_OFFSET:
+    key_config->deadzones.start_offset = value;
+    break;
+  case VENDOR_FIELD_END_OFFSET:
+    key_config->deadzones.end_offset = value;
+    break;
+  case VENDOR_FIELD_ACTUATION_DISTANCE:
+    key_config->actuation_distance = value;
+    break;
+  case VENDOR_FIELD_RELEASE_DISTANCE:
+    key_config->release_distance = value;
+    break;
+  case VENDOR_FIELD_RAPID_TRIGGER_ENABLED:
+    key_config->rapid_trigger.is_enabled = value;
+    break;
+  case VENDOR_FIELD_RAPID_TRIGGER_CONTINUOUS:
+    key_config->rapid_trigger.is_continuous = value;
+    break;
+  case VENDOR_FIELD_RAPID_TRIGGER_ACTUATION_DELTA:
+    key_config->rapid_trigger.actuation_distance_delta = value;
+    break;
+  case VENDOR_FIELD_RAPID_TRIGGER_RELEASE_DELTA:
+    key_config->rapid_trigger.release_distance_delta = value;
+    break;
+  default:
+    config->keymap[field - VENDOR_FIELD_KEYMAP][key] = value;
+    break;
+  }
+}
+
+static uint8_t get_info(struct vendor_response *response) {
+  uint8_t *payload = response->data + VENDOR_RESPONSE_HEADER_LENGTH;
+
+  payload[0] = VENDOR_PROTOCOL_VERSION;
+  payload[1] = KEYS_COUNT;
+  payload[2] = LAYERS_COUNT;
+  payload[3] = PROFILES_COUNT;
+  payload[4] = profile_get_active();
+  put_u32(payload + 5, config_get_version());
+  payload[9] = stream_rate_hz;
+  response->length += 10;
+
+  return VENDOR_STATUS_OK;
+}
+
+static uint8_t read_fields(const uint8_t *payload, uint8_t length, struct vendor_response *response) {
+  if (length % 2 != 0 || length > VENDOR_RESPONSE_PAYLOAD_LENGTH) {
+    return VENDOR_STATUS_INVALID_ARGUMENT;
+  }
+
+  struct keys_config config;
+  config_snapshot(&config);
+
+  uint8_t status = VENDOR_STATUS_OK;
+  for (int i = 0; i < length; i += 2) {
+    int value = payload[i] < KEYS_COUNT ? field_value(&config, payload[i], payload[i + 1]) : -1;
+    if (value < 0) {
+      status = VENDOR_STATUS_INVALID_ARGUMENT;
+      break;
+    }
+    put_u16(response->data + response->length, value);
+    response->length += 2;
+  }
+
+  return status;
+}
+
+static uint8_t write_fields(const uint8_t *payload, uint8_t length, struct vendor_response *response) {
+  if (length == 0 || length % 4 != 0) {
+    return VENDOR_STATUS_INVALID_ARGUMENT;
+  }
+
+  // Validate the whole batch first so it is applied entirely or not at all
+  for (int i = 0; i < length; i += 4) {
+    if (!is_valid_field(payload[i], payload[i + 1], get_u16(payload + i + 2))) {
+      return VENDOR_STATUS_INVALID_ARGUMENT;
+    }
+  }
+
+  struct keys_config *config = config_begin_edit();
+  if (config == NULL) {
+    return VENDOR_STATUS_BUSY;
+  }
+  for (int i = 0; i < length; i += 4) {
+    set_field(config, payload[i], payload[i + 1], get_u16(payload + i + 2));
+  }
+  // Thresholds are only checked against each other once the whole batch is in
+  if (!config_is_valid(config)) {
+    config_cancel_edit();
+    return VENDOR_STATUS_INVALID_ARGUMENT;
+  }
+  config_publish();
+
+  response->data[response->length++] = length / 4;
+  return VENDOR_STATUS_OK;
+}
+
+static uint8_t read_calibration(const uint8_t *payload, uint8_t length, struct vendor_response *response) {
+  const int entry_length = 12;
+
+  if (length != 1 || payload[0] >= KEYS_COUNT) {
+    return VENDOR_STATUS_INVALID_ARGUMENT;
+  }
+
+  uint8_t first_key = payload[0];
+  uint8_t count = (VENDOR_RESPONSE_PAYLOAD_LENGTH - 2) / entry_length;
+  if (count > KEYS_COUNT - first_key) {
+    count = KEYS_COUNT - first_key;
+  }
+
+  uint8_t *entry = response->data + response->length;
+  entry[0] = first_key;
+  entry[1] = count;
+  entry += 2;
+  for (int i = first_key; i < first_key + count; i++, entry += entry_length) {
+    put_u16(entry, keys_state.idle_value[i]);
+    put_u16(entry + 2, keys_state.max_distance[i]);
+    entry[4] = keys_state.distance[i];
+    entry[5] = keys_state.is_idle[i];
+
+    struct key_noise key_noise;
+    noise_get_key_noise(i, &key_noise);
+    entry[6] = key_noise.start_offset;
+    entry[7] = key_noise.end_offset;
+    put_u16(entry + 8, key_noise.idle_sigma);
+    put_u16(entry + 10, key_noise.bottom_sigma);
+  }
+  response->length += 2 + count * entry_length;
+
+  return VENDOR_STATUS_OK;
+}
+
+static uint8_t read_counters(const uint8_t *payload, uint8_t length, struct vendor_response *response) {
+  const int entry_length = 12;
+
+  if (length != 1 || payload[0] >= KEYS_COUNT) {
+    return VENDOR_STATUS_INVALID_ARGUMENT;
+  }
+
+  uint8_t first_key = payload[0];
+  uint8_t count = (VENDOR_RESPONSE_PAYLOAD_LENGTH - 2) / entry_length;
+  if (count > KEYS_COUNT - first_key) {
+    count = KEYS_COUNT - first_key;
+  }
+
+  uint8_t *entry = response->data + response->length;
+  entry[0] = first_key;
+  entry[1] = count;
+  entry += 2;
+  for (int i = first_key; i < first_key + count; i++, entry += entry_length) {
+    struct scan_stats stats;
+    sensor_get_scan_stats(i, &stats);
+    put_u32(entry, keys[i].press_count);
+    put_u16(entry + 4, stats.rate_hz > UINT16_MAX ? UINT16_MAX : stats.rate_hz);
+    put_u16(entry + 6, stats.jitter_us > UINT16_MAX ? UINT16_MAX : stats.jitter_us);
+    put_u32(entry + 8, stats.rejected_samples);
+  }
+  response->length += 2 + count * entry_length;
+
+  return VENDOR_STATUS_OK;
+}
+
+static uint8_t read_power_stats(struct vendor_response *response) {
+  struct power_stats stats;
+  uint8_t *payload = response->data + VENDOR_RESPONSE_HEADER_LENGTH;
+
+  power_get_stats(&stats);
+  payload[0] = power_get_state();
+  put_u32(payload + 1, stats.time_in_state_us[POWER_STATE_ACTIVE] / 1000);
+  put_u32(payload + 5, stats.time_in_state_us[POWER_STATE_IDLE] / 1000);
+  put_u32(payload + 9, stats.idle_entries);
+  put_u16(payload + 13, battery_get_mv());
+  payload[15] = battery_get_level();
+  response->length += 16;
+
+  return VENDOR_STATUS_OK;
+}
+
+static uint8_t read_link_info(struct vendor_response *response) {
+  struct hid_link_info info;
+  struct link_sync_stats stats;
+  uint8_t *payload = response->data + VENDOR_RESPONSE_HEADER_LENGTH;
+
+  hid_get_link_info(&info);
+  link_sync_get_stats(&stats);
+  payload[0] = info.tx_phy;
+  payload[1] = info.rx_phy;
+  put_u16(payload + 2, info.tx_octets);
+  put_u16(payload + 4, info.rx_octets);
+  put_u32(payload + 6, stats.latency_avg_us);
+  put_u32(payload + 10, stats.latency_max_us);
+  put_u32(payload + 14, stats.event_latency_avg_us);
+  put_u32(payload + 18, stats.event_latency_max_us);
+  response->length += 22;
+
+  return VENDOR_STATUS_OK;
+}
+
+static uint8_t run_crosstalk(const uint8_t *payload, uint8_t length, struct vendor_response *response) {
+  uint8_t first = length == 2 ? payload[1] : 0;
+  if ((length != 1 && length != 2) || first >= KEYS_COUNT * KEYS_COUNT) {
+    return VENDOR_STATUS_INVALID_ARGUMENT;
+  }
+
+  esp_err_t ret = ESP_OK;
+  switch (payload[0]) {
+  case VENDOR_CROSSTALK_READ:
+    break;
+  case VENDOR_CROSSTALK_START:
+    ret = crosstalk_start_calibration();
+    break;
+  case VENDOR_CROSSTALK_FINISH:
+    ret = crosstalk_finish_calibration();
+    break;
+  case VENDOR_CROSSTALK_CANCEL:
+    crosstalk_cancel_calibration();
+    break;
+  case VENDOR_CROSSTALK_CLEAR:
+    ret = crosstalk_clear();
+    break;
+  default:
+    return VENDOR_STATUS_INVALID_ARGUMENT;
+  }
+  if (ret == ESP_ERR_INVALID_STATE || ret == ESP_ERR_TIMEOUT) {
+    return VENDOR_STATUS_BUSY;
+  }
+  if (ret != ESP_OK) {
+    return VENDOR_STATUS_FAILED;
+  }
+
+  // The matrix is read in slices of as many coefficients as fit
+  uint8_t *entry = response->data + response->length;
+  uint8_t count = (VENDOR_RESPONSE_PAYLOAD_LENGTH - 4) / 2;
+  if (count > KEYS_COUNT * KEYS_COUNT - first) {
+    count = KEYS_COUNT * KEYS_COUNT - first;
+  }
+  entry[0] = crosstalk_get_state();
+  entry[1] = crosstalk_get_calibrated_keys();
+  entry[2] = first;
+  entry[3] = count;
+  for (int i = 0; i < count; i++) {
+    int index = first + i;
+    put_u16(entry + 4 + 2 * i, crosstalk_get_coefficient(index / KEYS_COUNT, index % KEYS_COUNT));
+  }
+  response->length += 4 + 2 * count;
+
+  return VENDOR_STATUS_OK;
+}
+
+static uint8_t save_profile(const uint8_t *payload, uint8_t length) {
+  char name[PROFILE_NAME_LENGTH] = { 0 };
+
+  if (length < 1 || payload[0] >= PROFILES_COUNT) {
+    return VENDOR_STATUS_INVALID_ARGUMENT;
+  }
+
+  memcpy(name, payload + 1, length - 1 < PROFILE_NAME_LENGTH - 1 ? length - 1 : PROFILE_NAME_LENGTH - 1);
+  return profile_save(payload[0], name) == ESP_OK ? VENDOR_STATUS_OK : VENDOR_STATUS_FAILED;
+}
+
+static uint8_t select_profile(const uint8_t *payload, uint8_t length) {
+  if (length != 1 || payload[0] >= PROFILES_COUNT) {
+    return VENDOR_STATUS_INVALID_ARGUMENT;
+  }
+
+  esp_err_t ret = profile_select(payload[0]);
+  if (ret == ESP_ERR_TIMEOUT) {
+    return VENDOR_STATUS_BUSY;
+  }
+  return ret == ESP_OK ? VENDOR_STATUS_OK : VENDOR_STATUS_FAILED;
+}
+
+static uint8_t set_stream(const uint8_t *payload, uint8_t length) {
+  if (length != 1 || payload[0] > VENDOR_STREAM_MAX_RATE_HZ) {
+    return VENDOR_STATUS_INVALID_ARGUMENT;
+  }
+
+  stream_rate_hz = payload[0];
+  ESP_LOGI(TAG, "key travel stream at %d Hz", stream_rate_hz);
+  return VENDOR_STATUS_OK;
+}
+
+static void handle_request(const struct vendor_request *request) {
+  struct vendor_response response = { 0 };
+  const uint8_t *payload = request->data + VENDOR_HEADER_LENGTH;
+  uint8_t length = request->length - VENDOR_HEADER_LENGTH;
+  uint8_t command = request->data[1];
+  uint8_t status;
+
+  response.data[0] = request->data[0];
+  response.data[1] = command;
+  response.length = VENDOR_RESPONSE_HEADER_LENGTH;
+
+  switch (command) {
+  case VENDOR_COMMAND_GET_INFO:
+    status = get_info(&response);
+    break;
+  case VENDOR_COMMAND_READ_FIELDS:
+    status = read_fields(payload, length, &response);
+    break;
+  case VENDOR_COMMAND_WRITE_FIELDS:
+    status = write_fields(payload, length, &response);
+    break;
+  case VENDOR_COMMAND_READ_CALIBRATION:
+    status = read_calibration(payload, length, &response);
+    break;
+  case VENDOR_COMMAND_READ_COUNTERS:
+    status = read_counters(payload, length, &response);
+    break;
+  case VENDOR_COMMAND_SELECT_PROFILE:
+    status = select_profile(payload, length);
+    break;
+  case VENDOR_COMMAND_SAVE_PROFILE:
+    status = save_profile(payload, length);
+    break;
+  case VENDOR_COMMAND_SET_STREAM:
+    status = set_stream(payload, length);
+    break;
+  case VENDOR_COMMAND_READ_POWER_STATS:
+    status = read_power_stats(&response);
+    break;
+  case VENDOR_COMMAND_READ_LINK_INFO:
+    status = read_link_info(&response);
+    break;
+  case VENDOR_COMMAND_CROSSTALK:
+    status = run_crosstalk(payload, length, &response);
+    break;
+  default:
+    status = VENDOR_STATUS_UNKNOWN_COMMAND;
+    break;
+  }
+
+  // Errors carry no payload
+  response.data[2] = status;
+  if (status != VENDOR_STATUS_OK) {
+    response.length = VENDOR_RESPONSE_HEADER_LENGTH;
+  }
+  hid_send_vendor(response.data, response.length);
+}
+
+// Live key travel, split over as many reports as the key count needs
+static void send_stream(uint8_t sequence) {
+  const uint8_t keys_per_report = HID_VENDOR_REPORT_LENGTH - 4;
+  uint8_t report[HID_VENDOR_REPORT_LENGTH];
+
+  for (int first_key = 0; first_key < KEYS_COUNT; first_key += keys_per_report) {
+    uint8_t count = KEYS_COUNT - first_key < keys_per_report ? KEYS_COUNT - first_key : keys_per_report;
+    report[0] = sequence;
+    report[1] = VENDOR_COMMAND_STREAM;
+    report[2] = first_key;
+    report[3] = count;
+    memcpy(report + 4, &keys_state.distance[first_key], count);
+    hid_send_vendor(report, 4 + count);
+  }
+}
+
+static void vendor_task(void *pvParameters) {
+  struct vendor_request request;
+  TickType_t next_stream_at = xTaskGetTickCount();
+  uint8_t stream_sequence = 0;
+
+  while (1) {
+    TickType_t wait = portMAX_DELAY;
+    if (stream_rate_hz > 0) {
+      TickType_t now = xTaskGetTickCount();
+      wait = (int32_t)(next_stream_at - now) > 0 ? next_stream_at - now : 0;
+    }
+
+    if (xQueueReceive(request_queue, &request, wait) == pdTRUE) {
+      handle_request(&request);
+    }
+
+    if (stream_rate_hz > 0 && (int32_t)(xTaskGetTickCount() - next_stream_at) >= 0) {
+      TickType_t period = pdMS_TO_TICKS(1000 / stream_rate_hz);
+      next_stream_at = xTaskGetTickCount() + (period > 0 ? period : 1);
+      if (hid_is_connected()) {
+        send_stream(stream_sequence++);
+      }
+    }
+  }
+}
+
+void vendor_init() {
+  request_queue = xQueueCreate(VENDOR_QUEUE_LENGTH, sizeof(struct vendor_request));
+  xTaskCreate(vendor_task, "vendor_task", 3072, NULL, 5, NULL);
+  hid_set_vendor_handler(vendor_receive);
+}
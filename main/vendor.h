@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+// Binary protocol carried by the vendor HID reports.
+// Requests (output report): [sequence][command][payload...]
+// Responses (input report): [sequence][command][status][payload...]
+// Multi-byte values are little-endian.
+#define VENDOR_PROTOCOL_VERSION 1
+#define VENDOR_STREAM_MAX_RATE_HZ 100
+
+enum vendor_command {
+  // -> [protocol version][keys][layers][profiles][active profile][config version:4][stream rate]
+  VENDOR_COMMAND_GET_INFO = 0x01,
+  // [key][field]... -> [value:2]...
+  VENDOR_COMMAND_READ_FIELDS = 0x02,
+  // [key][field][value:2]... -> [fields written], all fields are published at once or none
+  VENDOR_COMMAND_WRITE_FIELDS = 0x03,
+  // [first key] -> [first key][count] then per key [idle value:2][max distance:2][distance][is idle]
+  //   [start deadzone][end deadzone][idle noise:2][bottom noise:2], noise as a standard deviation in 1/16 mV
+  VENDOR_COMMAND_READ_CALIBRATION = 0x04,
+  // [first key] -> [first key][count] then per key [presses:4][scan rate Hz:2][scan jitter us:2][rejected samples:4]
+  VENDOR_COMMAND_READ_COUNTERS = 0x05,
+  // [profile] ->
+  VENDOR_COMMAND_SELECT_PROFILE = 0x06,
+  // [profile][name...] ->
+  VENDOR_COMMAND_SAVE_PROFILE = 0x07,
+  // [rate Hz], 0 stops the stream ->
+  VENDOR_COMMAND_SET_STREAM = 0x08,
+  // -> [power state][active ms:4][idle ms:4][idle entries:4][battery mV:2][battery %]
+  VENDOR_COMMAND_READ_POWER_STATS = 0x09,
+  // -> [tx PHY][rx PHY][tx octets:2][rx octets:2][report latency avg us:4][report latency max us:4]
+  //   [key event latency avg us:4][key event latency max us:4]
+  VENDOR_COMMAND_READ_LINK_INFO = 0x0A,
+  // [action][first coefficient, optional] -> [state][calibrated keys][first coefficient][count][coefficient:2]...
+  //   coefficients row by affected key, in 1/4096
+  VENDOR_COMMAND_CROSSTALK = 0x0B,
+  // Unsolicited, sequence is a free-running counter: [first key][count][distance]...
+  VENDOR_COMMAND_STREAM = 0x80,
+};
+
+enum vendor_status {
+  VENDOR_STATUS_OK = 0x00,
+  VENDOR_STATUS_UNKNOWN_COMMAND = 0x01,
+  VENDOR_STATUS_INVALID_ARGUMENT = 0x02,
+  VENDOR_STATUS_BUSY = 0x03,
+  VENDOR_STATUS_FAILED = 0x04,
+};
+
+enum vendor_crosstalk_action {
+  VENDOR_CROSSTALK_READ = 0x00,
+  // Release every key, then press each one alone until finished
+  VENDOR_CROSSTALK_START = 0x01,
+  VENDOR_CROSSTALK_FINISH = 0x02,
+  VENDOR_CROSSTALK_CANCEL = 0x03,
+  VENDOR_CROSSTALK_CLEAR = 0x04,
+};
+
+enum vendor_field {
+  VENDOR_FIELD_START_OFFSET = 0x00,
+  VENDOR_FIELD_END_OFFSET = 0x01,
+  VENDOR_FIELD_ACTUATION_DISTANCE = 0x02,
+  VENDOR_FIELD_RELEASE_DISTANCE = 0x03,
+  VENDOR_FIELD_RAPID_TRIGGER_ENABLED = 0x04,
+  VENDOR_FIELD_RAPID_TRIGGER_CONTINUOUS = 0x05,
+  VENDOR_FIELD_RAPID_TRIGGER_ACTUATION_DELTA = 0x06,
+  VENDOR_FIELD_RAPID_TRIGGER_RELEASE_DELTA = 0x07,
+  // Action of the key on layer n is VENDOR_FIELD_KEYMAP + n
+  VENDOR_FIELD_KEYMAP = 0x10,
+};
+
+/**
+ * @brief Start the vendor protocol task and register it with the HID layer
+ */
+void vendor_init(void);